@@ -0,0 +1,290 @@
+// Ahead of time recompiler: CHIP-8 ROM -> C++ -> shared object.
+// Code reachable from 0x200 is found by recursive descent and every basic
+// block becomes one C++ function. The result is loaded with Chip8::LoadAot,
+// anything that wasn't found here (computed jumps, self-modified code) still
+// runs in the interpreter.
+//
+// Usage: ./chip8-aot [-k] <ROM file> <output .so>
+//          -k  keep the generated .cpp next to the output
+//        compiler can be changed with CXX environment variable
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "aot.h"
+
+enum Kind {
+  UNKNOWN,
+  NATIVE,      // translated to C++
+  HANDLER,     // calls the interpreter handler
+  HANDLER_END, // calls the handler and ends the block (pc may change, screen or code changed)
+  JUMP,        // 1NNN
+  JUMP_V,      // BNNN, target unknown
+  CALL,        // 2NNN
+  RET,         // 00EE
+  SKIP,        // 3XNN 4XNN 5XY0 9XY0 EX9E EXA1
+  KEY_WAIT,    // FX0A
+  TIMER        // FX07 FX15 FX18, left to the interpreter
+};
+
+// same priority as Chip8::opcode_table
+Kind Classify(uint16_t op){
+
+  uint8_t n = op & 0xF, nn = op & 0xFF;
+
+  switch(op >> 12) {
+    case 0x0:
+      if(op == 0x00E0 || op == 0x00FB || op == 0x00FC || (op & 0xFFF0) == 0x00C0 ||
+         (op & 0xFFF0) == 0x00D0) return HANDLER;
+      if(op == 0x00EE) return RET;
+      if(op == 0x00FD || op == 0x00FE || op == 0x00FF) return HANDLER_END;
+      return NATIVE; // 0NNN does nothing
+    case 0x1: return JUMP;
+    case 0x2: return CALL;
+    case 0x3: case 0x4: return SKIP;
+    case 0x5: case 0x9: return (n == 0) ? SKIP : UNKNOWN;
+    case 0x6: case 0x7: case 0xA: return NATIVE;
+    case 0x8: return (n <= 7 || n == 0xE) ? NATIVE : UNKNOWN;
+    case 0xB: return JUMP_V;
+    case 0xC: return HANDLER;
+    case 0xD: return HANDLER_END;
+    case 0xE: return (nn == 0x9E || nn == 0xA1) ? SKIP : UNKNOWN;
+    case 0xF:
+      switch(nn) {
+        case 0x0A: return KEY_WAIT;
+        case 0x07: case 0x15: case 0x18: return TIMER;
+        case 0x1E: case 0x29: case 0x30: case 0x65: return NATIVE;
+        case 0x75: case 0x85: return HANDLER;
+        case 0x33: case 0x55: return HANDLER_END;
+      }
+      return UNKNOWN;
+  }
+  return UNKNOWN;
+}
+
+bool EndsBlock(Kind kind){
+  return kind != NATIVE && kind != HANDLER;
+}
+
+uint8_t memory[4096];
+
+uint16_t Opcode(uint16_t addr){
+  return memory[addr] << 8 | memory[addr + 1];
+}
+
+char buf[256];
+
+// C++ for one instruction, mirrors the handlers in chip8.cpp
+std::string EmitInstr(uint16_t addr, uint16_t op){
+
+  unsigned int x = (op >> 8) & 0xF, y = (op >> 4) & 0xF, n = op & 0xF;
+  unsigned int nn = op & 0xFF, nnn = op & 0xFFF;
+  unsigned int next = addr + 2;
+
+  switch(Classify(op)) {
+
+    case NATIVE:
+      switch(op >> 12) {
+        case 0x0: snprintf(buf, sizeof(buf), "  // %04x ignored\n", op); break;
+        case 0x6: snprintf(buf, sizeof(buf), "  V[%u] = %u;\n", x, nn); break;
+        case 0x7: snprintf(buf, sizeof(buf), "  V[%u] += %u;\n", x, nn); break;
+        case 0xA: snprintf(buf, sizeof(buf), "  *I = %u;\n", nnn); break;
+        case 0x8:
+          switch(n) {
+            case 0x0: snprintf(buf, sizeof(buf), "  V[%u] = V[%u];\n", x, y); break;
+            case 0x1: snprintf(buf, sizeof(buf), "  V[%u] |= V[%u];\n", x, y); break;
+            case 0x2: snprintf(buf, sizeof(buf), "  V[%u] &= V[%u];\n", x, y); break;
+            case 0x3: snprintf(buf, sizeof(buf), "  V[%u] ^= V[%u];\n", x, y); break;
+            case 0x4: snprintf(buf, sizeof(buf), "  { uint16_t t = V[%u] + V[%u]; V[%u] = t; V[15] = t >= 0x100; }\n", x, y, x); break;
+            case 0x5: snprintf(buf, sizeof(buf), "  { int16_t t = V[%u] - V[%u]; V[%u] = t; V[15] = t >= 0; }\n", x, y, x); break;
+            case 0x7: snprintf(buf, sizeof(buf), "  { int16_t t = V[%u] - V[%u]; V[%u] = t; V[15] = t >= 0; }\n", y, x, x); break;
+            case 0x6: snprintf(buf, sizeof(buf), "  { if(!*c->quirk_shift) V[%u] = V[%u]; uint8_t b = V[%u] & 1; V[%u] >>= 1; V[15] = b; }\n", x, y, x, x); break;
+            case 0xE: snprintf(buf, sizeof(buf), "  { if(!*c->quirk_shift) V[%u] = V[%u]; uint8_t b = V[%u] >> 7; V[%u] <<= 1; V[15] = b; }\n", x, y, x, x); break;
+          }
+          break;
+        case 0xF:
+          switch(nn) {
+            case 0x1E: snprintf(buf, sizeof(buf), "  if(*I + V[%u] > 4095) V[15] = 1;\n  *I += V[%u];\n", x, x); break;
+            case 0x29: snprintf(buf, sizeof(buf), "  *I = V[%u] * 5;\n", x); break;
+            case 0x30: snprintf(buf, sizeof(buf), "  *I = 80 + V[%u] * 10;\n", x); break;
+            case 0x65: {
+              std::string s;
+              for(unsigned int i = 0; i <= x; i++) {
+                snprintf(buf, sizeof(buf), "  V[%u] = c->memory[*I + %u];\n", i, i);
+                s += buf;
+              }
+              return s;
+            }
+          }
+          break;
+      }
+      return buf;
+
+    case HANDLER:
+    case HANDLER_END:
+    case CALL:
+    case RET:
+      snprintf(buf, sizeof(buf), "  *pc = %u;\n  c->call_handler(c->chip8, 0x%04x);\n", next, op);
+      return buf;
+
+    case JUMP:
+      snprintf(buf, sizeof(buf), "  *pc = %u;\n", nnn);
+      return buf;
+
+    case JUMP_V:
+      snprintf(buf, sizeof(buf), "  *pc = (%u + V[*c->quirk_jump ? %u : 0]) & 0xfff;\n", nnn, x);
+      return buf;
+
+    case SKIP:
+      switch(op >> 12) {
+        case 0x3: snprintf(buf, sizeof(buf), "  *pc = (V[%u] == %u) ? %u : %u;\n", x, nn, next + 2, next); break;
+        case 0x4: snprintf(buf, sizeof(buf), "  *pc = (V[%u] != %u) ? %u : %u;\n", x, nn, next + 2, next); break;
+        case 0x5: snprintf(buf, sizeof(buf), "  *pc = (V[%u] == V[%u]) ? %u : %u;\n", x, y, next + 2, next); break;
+        case 0x9: snprintf(buf, sizeof(buf), "  *pc = (V[%u] != V[%u]) ? %u : %u;\n", x, y, next + 2, next); break;
+        default: snprintf(buf, sizeof(buf), "  *pc = %u;\n  c->call_handler(c->chip8, 0x%04x);\n", next, op); break;
+      }
+      return buf;
+
+    case KEY_WAIT:
+      snprintf(buf, sizeof(buf), "  if(*c->last_key_pressed == -1) { *pc = %u; c->key_wait = true; }\n  else { V[%u] = *c->last_key_pressed; *pc = %u; }\n", addr, x, next);
+      return buf;
+
+    default:
+      return "";
+  }
+}
+
+// single quoted for system(), a ' inside becomes '\''
+std::string ShellQuote(const std::string &s){
+  std::string quoted = "'";
+  for(char c : s) {
+    if(c == '\'') quoted += "'\\''";
+    else quoted += c;
+  }
+  return quoted + "'";
+}
+
+int main(int argc, char* argv[]){
+
+  std::vector<std::string> args(argv, argv+argc);
+  bool keep = false;
+  if(args.size() > 1 && args[1] == "-k") {
+    keep = true;
+    args.erase(args.begin() + 1);
+  }
+
+  if(args.size() != 3) {
+    std::cerr << "Usage: chip8-aot [-k] <ROM file> <output .so>" << '\n';
+    return -1;
+  }
+
+  FILE *f = fopen(args[1].c_str(), "rb");
+  if(f == nullptr) {
+    std::cerr << "Can't open " << args[1] << '\n';
+    return -1;
+  }
+  size_t rom_size = fread(memory + 0x200, 1, 4096 - 0x200, f);
+  fclose(f);
+
+  // recursive descent, collect addresses where blocks start
+  std::set<uint16_t> leaders;
+  std::vector<uint16_t> work = {0x200};
+  std::vector<bool> visited(4096, false);
+
+  while(!work.empty()) {
+    uint16_t addr = work.back();
+    work.pop_back();
+    if(addr + 1 >= 4096) continue;
+    // targets in the middle of already walked code still get their own block
+    leaders.insert(addr);
+    if(visited[addr]) continue;
+
+    for(; addr + 1 < 4096 && !visited[addr]; addr += 2) {
+      visited[addr] = true;
+      uint16_t op = Opcode(addr);
+      Kind kind = Classify(op);
+
+      if(kind == UNKNOWN || kind == JUMP_V || kind == RET) break;
+      if(kind == JUMP) { work.push_back(op & 0xFFF); break; }
+      if(kind == CALL) { work.push_back(op & 0xFFF); work.push_back(addr + 2); break; }
+      if(kind == SKIP) { work.push_back(addr + 2); work.push_back(addr + 4); break; }
+      if(EndsBlock(kind)) { work.push_back(addr + 2); break; }
+    }
+  }
+
+  std::stringstream src;
+  src << AOT_HEADER_SRC << '\n';
+
+  struct Block { uint16_t start, end, count; };
+  std::vector<Block> blocks;
+  const unsigned int MAX_BLOCK_INSTRS = 64;
+
+  for(uint16_t start : leaders) {
+    std::string body;
+    uint16_t addr = start;
+    unsigned int count = 0;
+    bool ended = false;
+
+    while(!ended && count < MAX_BLOCK_INSTRS && addr + 1 < 4096) {
+      uint16_t op = Opcode(addr);
+      Kind kind = Classify(op);
+      if(kind == UNKNOWN || kind == TIMER) break;
+
+      body += EmitInstr(addr, op);
+      ended = EndsBlock(kind);
+      addr += 2;
+      count++;
+    }
+    if(count == 0) continue;
+
+    // handlers and branches set pc themselves
+    if(!ended) {
+      snprintf(buf, sizeof(buf), "  *pc = %u;\n", addr);
+      body += buf;
+    }
+
+    src << "static void blk_" << std::hex << start << std::dec << "(AotContext *c) {\n"
+        << "  uint8_t *V = c->V; uint16_t *I = c->I; uint16_t *pc = c->pc;\n"
+        << "  (void)V; (void)I;\n"
+        << body << "}\n\n";
+    blocks.push_back({start, addr, (uint16_t)count});
+  }
+
+  src << "extern \"C\" {\n\n";
+  src << "int aot_abi_version = " << AOT_ABI_VERSION << ";\n";
+  src << "unsigned int aot_rom_size = " << rom_size << ";\n";
+  src << "unsigned int aot_block_count = " << blocks.size() << ";\n\n";
+
+  src << "extern const uint8_t aot_rom[] = {";
+  for(size_t i = 0; i < rom_size; i++) src << (i % 16 ? " " : "\n  ") << (int)memory[0x200 + i] << ",";
+  src << "\n};\n\n";
+
+  src << "extern const AotBlock aot_blocks[] = {\n";
+  for(auto &b : blocks)
+    src << "  { " << b.start << ", " << b.end << ", " << b.count << ", blk_" << std::hex << b.start << std::dec << " },\n";
+  src << "};\n\n}\n";
+
+  std::string out = args[2];
+  std::string cpp = out + ".cpp";
+  std::ofstream(cpp) << src.str();
+
+  const char *cxx = getenv("CXX");
+  // CXX is left as it is, it may carry flags
+  std::string cmd = std::string(cxx ? cxx : "c++") + " -O2 -shared -fPIC -o " + ShellQuote(out) + " " + ShellQuote(cpp);
+  int ret = system(cmd.c_str());
+  if(!keep) remove(cpp.c_str());
+
+  if(ret != 0) {
+    std::cerr << "Compilation failed: " << cmd << '\n';
+    return -1;
+  }
+
+  printf("%s: %zu blocks from %zu bytes\n", out.c_str(), blocks.size(), rom_size);
+  return 0;
+}
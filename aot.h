@@ -0,0 +1,55 @@
+#pragma once
+// Interface between Chip8 and ROMs recompiled ahead of time by chip8-aot (aot.cpp).
+// Generated shared objects export:
+//   int aot_abi_version;
+//   const uint8_t aot_rom[];  unsigned int aot_rom_size;  ROM the code was built from
+//   const AotBlock aot_blocks[];  unsigned int aot_block_count;
+#include <stdint.h>
+
+#define AOT_ABI_VERSION 4
+
+// pointers into the Chip8 that runs the code
+struct AotContext {
+  void *chip8;
+  uint8_t *memory;
+  uint8_t *V;
+  uint16_t *I;
+  uint16_t *pc;
+  int *last_key_pressed;
+  bool *quirk_shift;
+  bool *quirk_jump;
+  // set by FX0A while no key is pressed
+  bool key_wait;
+  // runs the interpreter handler of an opcode
+  void (*call_handler)(void *chip8, uint32_t opcode);
+};
+
+// executes exactly 'count' instructions starting at 'start' and sets pc
+struct AotBlock {
+  uint16_t start;
+  uint16_t end;
+  uint16_t count;
+  void (*run)(AotContext *ctx);
+};
+
+// the same declarations, written at the top of every generated file
+static const char AOT_HEADER_SRC[] = R"(#include <stdint.h>
+struct AotContext {
+  void *chip8;
+  uint8_t *memory;
+  uint8_t *V;
+  uint16_t *I;
+  uint16_t *pc;
+  int *last_key_pressed;
+  bool *quirk_shift;
+  bool *quirk_jump;
+  bool key_wait;
+  void (*call_handler)(void *chip8, uint32_t opcode);
+};
+struct AotBlock {
+  uint16_t start;
+  uint16_t end;
+  uint16_t count;
+  void (*run)(AotContext *ctx);
+};
+)";
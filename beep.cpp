@@ -1,7 +1,10 @@
 #include "portaudio.h"
 #include <cstdio>
 
-class Beep {
+#include "chip8.h"
+
+// sound timer tone through PortAudio
+class Beep : public AudioSink {
   
   private:
     typedef struct {
@@ -59,7 +62,7 @@ class Beep {
       fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
     }
     
-    void Play() {
+    void Play() override {
       err = Pa_StartStream( stream );
       if(err != paNoError) {
         Error();
@@ -67,7 +70,7 @@ class Beep {
       }
     }
 
-    void Stop() {
+    void Stop() override {
       err = Pa_StopStream(stream);
       if(err != paNoError){
         Error();
@@ -0,0 +1,652 @@
+// Benchmark suite of the interpreter core.
+// Runs every ROM in the given directories headless for a fixed number of
+// frames with scripted input and reports instructions per second, ns per
+// frame, p50/p99 frame cost and the final screen hash of each.
+//
+// Usage: ./bench [-f <frames>] [-t <ticks>] [--core <table|threaded|jit|aot>] [-q <quirks>]
+//                [--aot-dir <dir>] [--movies <dir>] [--json <file>] [--compare <file>]
+//                [--threshold <percent>] [dir...]
+//        (default dirs: ROMS c8games sROMS)
+//        aot core loads <aot-dir>/<ROM file name>.so made by chip8-aot (default dir: aot)
+//        input is a fixed key pattern, or <movies>/<ROM file name>.movie when there is one
+//        (the movie sets quirks, ticks and seed)
+//        --json writes the results, --compare checks them against a file --json wrote
+//        and exits with 1 if a hash changed, a ROM in the file wasn't run or one got more
+//        than threshold percent (default 10) slower per frame. A file from another core,
+//        frame count, ticks or quirks isn't compared at all
+//        ./bench --scroll [-c <calls>]
+//        times every scroll kernel set on a random screen in hires and lores
+//        ./bench --state [-c <calls>] [dir...]
+//        times save states of every ROM after 10 seconds of play, in memory and to a file
+//        ./bench --rewind [dir...]
+//        captures a minute of every ROM into the rewind buffer, then rewinds all of it
+//        ./bench --opcodes [-c <cycles>] [--out <dir>] [--aot-dir <dir>]
+//        ns per instruction of every core on generated ROMs that stress one opcode
+//        family each (oprom.cpp). --out writes them as <dir>/<name>.ch8, compile
+//        those with chip8-aot into the aot dir to include the aot core
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <cstring>
+#include <stdexcept>
+
+#include "chip8.h"
+#include "rewind.h"
+#include "movie.h"
+#include "oprom.cpp"
+
+// ns per call of each scroll kernel, checked against the scalar ones
+int ScrollBench(uint64_t calls){
+
+  std::vector<const ScrollKernels*> sets = { &scroll_scalar };
+#if defined(__x86_64__)
+  sets.push_back(&scroll_sse2);
+  if(__builtin_cpu_supports("avx2")) sets.push_back(&scroll_avx2);
+#endif
+
+  const char *ops[] = { "right", "left", "down 5", "up 5" };
+  int ret = 0;
+
+  for(bool hires : { true, false }) {
+    int rows = hires ? 64 : 32;
+    for(int op = 0; op < 4; op++) {
+      uint64_t expected[64 * Chip8::DISPLAY_ROW_WORDS];
+      for(auto *set : sets) {
+        uint64_t display[64 * Chip8::DISPLAY_ROW_WORDS];
+        uint32_t x = 0x9E3779B9;
+        for(int i = 0; i < 64 * Chip8::DISPLAY_ROW_WORDS; i++) {
+          x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+          display[i] = (uint64_t)x << 32 | x;
+          if(!hires && (i & 1)) display[i] = 0;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < calls; i++) {
+          switch(op) {
+            case 0: set->right(display, rows, hires); break;
+            case 1: set->left(display, rows, hires); break;
+            case 2: set->down(display, rows, 5); break;
+            case 3: set->up(display, rows, 5); break;
+          }
+          // keep the screen from emptying so every call does the same work
+          display[(i & 31) * Chip8::DISPLAY_ROW_WORDS] ^= i | 1;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        if(set == sets[0]) memcpy(expected, display, sizeof(display));
+        bool ok = memcmp(expected, display, sizeof(display)) == 0;
+        if(!ok) ret = -1;
+
+        std::string name = std::string(hires ? "hires " : "lores ") + ops[op] + " " + set->name;
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / calls;
+        printf("%-50s %12.2f ns%s\n", name.c_str(), ns, ok ? "" : "  MISMATCH");
+      }
+    }
+  }
+  return ret;
+}
+
+// ns per save and load of the whole machine
+void StateBench(const std::vector<std::string> &roms, uint64_t calls){
+
+  Chip8::State *state = new Chip8::State;
+  std::string file = (std::filesystem::temp_directory_path() / "chip8-bench.state").string();
+  uint64_t file_calls = std::max<uint64_t>(1, calls / 100);
+  printf("%-50s %10s %10s %10s %10s\n", "", "save", "load", "file save", "file load");
+
+  for(auto &rom : roms) {
+    Chip8 chip8;
+    if(!chip8.LoadRom(rom.c_str())) continue;
+    chip8.Seed(1);
+    for(int frame = 0; frame < 600; frame++) chip8.RunUntilFrame();
+
+    auto t0 = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < calls; i++) chip8.SaveState(*state);
+    auto t1 = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < calls; i++) chip8.LoadState(*state);
+    auto t2 = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < file_calls; i++) chip8.SaveState(file.c_str());
+    auto t3 = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < file_calls; i++) chip8.LoadState(file.c_str());
+    auto t4 = std::chrono::steady_clock::now();
+
+    auto ns = [](auto a, auto b, uint64_t n) { return std::chrono::duration<double, std::nano>(b - a).count() / n; };
+    printf("%-50s %7.0f ns %7.0f ns %7.0f ns %7.0f ns\n", rom.c_str(),
+           ns(t0, t1, calls), ns(t1, t2, calls), ns(t2, t3, file_calls), ns(t3, t4, file_calls));
+  }
+  printf("state size: %zu bytes\n", sizeof(Chip8::State));
+  remove(file.c_str());
+  delete state;
+}
+
+// per frame capture cost and memory of the rewind buffer
+void RewindBench(const std::vector<std::string> &roms){
+
+  const int FRAMES = 60 * 60;
+  Rewind rewind(FRAMES);
+  printf("%-50s %12s %12s %12s %12s\n", "", "capture avg", "capture max", "step avg", "memory");
+
+  for(auto &rom : roms) {
+    Chip8 chip8;
+    if(!chip8.LoadRom(rom.c_str())) continue;
+    chip8.Seed(1);
+    rewind.Clear();
+
+    double capture_ns = 0, capture_max = 0;
+    for(int frame = 0; frame < FRAMES; frame++) {
+      // some input so games leave their title screens
+      if(frame % 120 == 60) chip8.SetKey(frame / 120 % 16, true);
+      if(frame % 120 == 70) chip8.SetKey(frame / 120 % 16, false);
+      chip8.RunUntilFrame();
+
+      auto start = std::chrono::steady_clock::now();
+      rewind.Capture(chip8);
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      capture_ns += ns;
+      capture_max = std::max(capture_max, ns);
+    }
+    size_t used = rewind.BytesUsed();
+
+    auto start = std::chrono::steady_clock::now();
+    int steps = 0;
+    while(rewind.Step(chip8)) steps++;
+    double step_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-50s %9.0f ns %9.0f ns %9.0f ns %9.0f KB\n", rom.c_str(),
+           capture_ns / FRAMES, capture_max, steps ? step_ns / steps : 0, used / 1024.0);
+  }
+}
+
+// ns per guest instruction of every core on every opcode ROM
+int OpcodeBench(uint64_t cycles, const std::string &out_dir, const std::string &aot_dir){
+
+  const Chip8::Core cores[] = { Chip8::Core::Table, Chip8::Core::Threaded, Chip8::Core::Jit, Chip8::Core::Aot };
+  int ret = 0;
+  printf("%-18s %-40s %10s %10s %10s %10s\n", "", "", "table", "threaded", "jit", "aot");
+
+  for(auto &rom : OpcodeRoms()) {
+    std::string file = rom.name;
+    std::replace(file.begin(), file.end(), ' ', '_');
+    std::replace(file.begin(), file.end(), '/', '_');
+    file += ".ch8";
+
+    if(!out_dir.empty()) {
+      std::filesystem::create_directories(out_dir);
+      FILE *f = fopen((out_dir + "/" + file).c_str(), "wb");
+      if(f) {
+        fwrite(rom.data.data(), 1, rom.data.size(), f);
+        fclose(f);
+      }
+    }
+
+    printf("%-18s %-40s", rom.name.c_str(), rom.description.c_str());
+    uint64_t expected_hash = 0;
+    for(auto core : cores) {
+      Chip8 chip8;
+      chip8.LoadRom(rom.data.data(), rom.data.size());
+      chip8.core = core;
+      chip8.cycles_per_frame = 1000;
+      chip8.Seed(1);
+      std::string so = aot_dir + "/" + file + ".so";
+      if(core == Chip8::Core::Aot && (!std::filesystem::exists(so) || !chip8.LoadAot(so.c_str()))) {
+        printf(" %10s", "-");
+        continue;
+      }
+
+      // the jit compiles the loop in here
+      chip8.RunCycles(1000);
+      auto start = std::chrono::steady_clock::now();
+      chip8.RunCycles(cycles);
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      printf(" %7.2f ns", ns / (chip8.instructions - 1000));
+
+      // every core has to end up in the same place
+      if(core == Chip8::Core::Table) expected_hash = chip8.ScreenHash();
+      else if(chip8.ScreenHash() != expected_hash) {
+        printf(" (screen differs)");
+        ret = 1;
+      }
+    }
+    printf("\n");
+  }
+  return ret;
+}
+
+struct RomResult {
+  std::string rom;
+  uint64_t frames = 0;
+  uint64_t instructions = 0;
+  double sec = 0;
+  double ns_per_frame = 0, p50_ns = 0, p99_ns = 0;
+  uint64_t hash = 0;
+  double Ips() const { return sec > 0 ? instructions / sec : 0; }
+};
+
+// how a run was set up, results of another setup aren't comparable
+struct BenchConfig {
+  std::string core;
+  uint64_t frames = 0;
+  unsigned int cycles_per_frame = 0;
+  std::string quirks;
+};
+
+// the same names -q takes
+std::string QuirksName(const struct Chip8::Quirks &q){
+  std::string name;
+  if(q.jump) name += ",jump";
+  if(q.shift) name += ",shift";
+  if(q.clip_sprite) name += ",clip";
+  return name.empty() ? "none" : name.substr(1);
+}
+
+// "" if they match, else what differs
+std::string ConfigDiff(const BenchConfig &base, const BenchConfig &run){
+  std::string diff;
+  if(base.core != run.core) diff += ", core " + base.core + " vs " + run.core;
+  if(base.frames != run.frames) diff += ", frames " + std::to_string(base.frames) + " vs " + std::to_string(run.frames);
+  if(base.cycles_per_frame != run.cycles_per_frame)
+    diff += ", cycles per frame " + std::to_string(base.cycles_per_frame) + " vs " + std::to_string(run.cycles_per_frame);
+  if(base.quirks != run.quirks) diff += ", quirks " + base.quirks + " vs " + run.quirks;
+  return diff.empty() ? diff : diff.substr(2);
+}
+
+// the same every run: one key every half second, held for 10 frames, so
+// games get past their menus and key waits
+void ScriptedInput(Chip8 &chip8, uint64_t frame){
+  int key = (frame / 30 * 7) % 16;
+  if(frame % 30 == 0) {
+    chip8.last_key_pressed = -1;
+    chip8.SetKey(key, true);
+  }
+  else if(frame % 30 == 10) {
+    chip8.last_key_pressed = -1;
+    chip8.SetKey(key, false);
+  }
+}
+
+RomResult RunRom(Chip8 &chip8, const std::string &rom, uint64_t frames, Movie *movie){
+
+  RomResult result;
+  result.rom = rom;
+  std::vector<double> frame_ns;
+  frame_ns.reserve(frames);
+
+  for(uint64_t frame = 0; frame < frames; frame++) {
+    if(movie && movie->Finished(chip8)) break;
+    if(!movie) ScriptedInput(chip8, frame);
+
+    auto start = std::chrono::steady_clock::now();
+    Chip8::RunStatus status = movie ? movie->RunUntilFrame(chip8) : chip8.RunUntilFrame();
+    auto end = std::chrono::steady_clock::now();
+    frame_ns.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+
+    if(status != Chip8::RunStatus::FrameEnd) break;
+  }
+
+  result.frames = frame_ns.size();
+  result.instructions = chip8.instructions;
+  for(double ns : frame_ns) result.sec += ns / 1e9;
+  if(!frame_ns.empty()) {
+    result.ns_per_frame = result.sec * 1e9 / frame_ns.size();
+    std::sort(frame_ns.begin(), frame_ns.end());
+    result.p50_ns = frame_ns[frame_ns.size() / 2];
+    result.p99_ns = frame_ns[std::min(frame_ns.size() - 1, frame_ns.size() * 99 / 100)];
+  }
+  result.hash = chip8.ScreenHash();
+  return result;
+}
+
+// for a JSON string, ROM file names can have anything in them
+std::string JsonEscape(const std::string &s){
+  std::string out;
+  for(unsigned char c : s) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    }
+    else if(c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    }
+    else out += c;
+  }
+  return out;
+}
+
+// one ROM per line, so --compare can read it back without a JSON parser
+bool WriteJson(const char *filename, const std::vector<RomResult> &results, const BenchConfig &config){
+
+  FILE *f = fopen(filename, "w");
+  if(f == nullptr) return false;
+  fprintf(f, "{\n  \"core\": \"%s\", \"frames\": %llu, \"cycles_per_frame\": %u, \"quirks\": \"%s\",\n  \"roms\": [\n",
+          config.core.c_str(), (unsigned long long)config.frames, config.cycles_per_frame, config.quirks.c_str());
+  for(size_t i = 0; i < results.size(); i++) {
+    const RomResult &r = results[i];
+    fprintf(f, "    {\"rom\": \"%s\", \"frames\": %llu, \"instructions\": %llu, \"ips\": %.0f, "
+               "\"ns_per_frame\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"hash\": \"%016llx\"}%s\n",
+            JsonEscape(r.rom).c_str(), (unsigned long long)r.frames, (unsigned long long)r.instructions, r.Ips(),
+            r.ns_per_frame, r.p50_ns, r.p99_ns, (unsigned long long)r.hash,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  return fclose(f) == 0;
+}
+
+// value of "key": in a line WriteJson wrote, strings unescaped
+std::string JsonField(const std::string &line, const std::string &key){
+  size_t pos = line.find("\"" + key + "\": ");
+  if(pos == std::string::npos) return "";
+  pos += key.size() + 4;
+  if(pos < line.size() && line[pos] == '"') {
+    std::string value;
+    for(pos++; pos < line.size() && line[pos] != '"'; pos++) {
+      if(line[pos] != '\\' || pos + 1 >= line.size()) value += line[pos];
+      else if(line[++pos] == 'u') {
+        value += (char)std::stoi(line.substr(pos + 1, 4), nullptr, 16);
+        pos += 4;
+      }
+      else value += line[pos];
+    }
+    return value;
+  }
+  size_t end = line.find_first_of(",}", pos);
+  return line.substr(pos, end - pos);
+}
+
+// false with the reason in 'error' if it can't be read or isn't what WriteJson wrote
+bool ReadJson(const char *filename, BenchConfig &config, std::vector<RomResult> &out, std::string &error){
+
+  FILE *f = fopen(filename, "r");
+  if(f == nullptr) {
+    error = "can't open it";
+    return false;
+  }
+  char buf[4096];
+  int line_number = 0;
+  bool ok = true, has_config = false;
+  while(ok && fgets(buf, sizeof(buf), f)) {
+    std::string line(buf);
+    line_number++;
+    size_t used;
+    if(line.find("\"core\": ") != std::string::npos) {
+      try {
+        config.core = JsonField(line, "core");
+        std::string frames = JsonField(line, "frames");
+        config.frames = std::stoull(frames, &used);
+        if(used != frames.size()) throw std::invalid_argument("frames");
+        std::string cycles = JsonField(line, "cycles_per_frame");
+        config.cycles_per_frame = std::stoul(cycles, &used);
+        if(used != cycles.size()) throw std::invalid_argument("cycles_per_frame");
+        config.quirks = JsonField(line, "quirks");
+        // files from before quirks were written
+        if(config.core.empty() || config.quirks.empty()) throw std::invalid_argument("config");
+        has_config = true;
+      }
+      catch(const std::exception &) {
+        error = "invalid baseline, line " + std::to_string(line_number);
+        ok = false;
+      }
+      continue;
+    }
+    if(line.find("\"rom\": ") == std::string::npos) continue;
+    // a missing field is an empty string, std::stod and friends throw on that too
+    try {
+      RomResult r;
+      r.rom = JsonField(line, "rom");
+      std::string ns = JsonField(line, "ns_per_frame");
+      r.ns_per_frame = std::stod(ns, &used);
+      if(used != ns.size()) throw std::invalid_argument("ns_per_frame");
+      std::string hash = JsonField(line, "hash");
+      r.hash = std::stoull(hash, &used, 16);
+      if(used != hash.size()) throw std::invalid_argument("hash");
+      out.push_back(r);
+    }
+    catch(const std::exception &) {
+      error = "invalid baseline, line " + std::to_string(line_number);
+      ok = false;
+    }
+  }
+  fclose(f);
+  if(ok && !has_config) {
+    error = "invalid baseline, no core, frames, cycles_per_frame and quirks in it";
+    ok = false;
+  }
+  else if(ok && out.empty()) {
+    error = "invalid baseline, no ROMs in it";
+    ok = false;
+  }
+  return ok;
+}
+
+// prints what changed, true if anything regressed
+bool Compare(const std::vector<RomResult> &results, const std::vector<RomResult> &baseline, double threshold){
+
+  bool regressed = false;
+  for(auto &r : results) {
+    auto base = std::find_if(baseline.begin(), baseline.end(), [&](const RomResult &b) { return b.rom == r.rom; });
+    if(base == baseline.end()) {
+      printf("%-50s not in the baseline\n", r.rom.c_str());
+      continue;
+    }
+    double change = base->ns_per_frame > 0 ? (r.ns_per_frame / base->ns_per_frame - 1) * 100 : 0;
+    const char *verdict = "";
+    if(r.hash != base->hash) verdict = "HASH CHANGED";
+    else if(change > threshold) verdict = "SLOWER";
+    else if(change < -threshold) verdict = "faster";
+    if(r.hash != base->hash || change > threshold) regressed = true;
+    printf("%-50s %10.1f -> %10.1f ns/frame %+7.1f%% %s\n", r.rom.c_str(), base->ns_per_frame, r.ns_per_frame, change, verdict);
+  }
+  // a ROM that stopped loading or went missing from the dirs
+  for(auto &b : baseline) {
+    if(std::none_of(results.begin(), results.end(), [&](const RomResult &r) { return r.rom == b.rom; })) {
+      printf("%-50s %10.1f -> %10s ns/frame %8s MISSING\n", b.rom.c_str(), b.ns_per_frame, "-", "");
+      regressed = true;
+    }
+  }
+  return regressed;
+}
+
+const char *USAGE = "Usage: ./bench [options...] [dir...]       ROMs of every dir, default ROMS c8games sROMS\n\
+              -f,  --frames <num>            Frames per ROM (default 3600)\n\
+              -t,  --ticks <num>             Ticks per second (default 30000)\n\
+              --core <name>                  table, threaded, jit or aot\n\
+              -q,  --quirks <list>           Comma separated quirks\n\
+              --aot-dir <dir>                Where the aot core finds <ROM file name>.so (default aot)\n\
+              --movies <dir>                 Input from <dir>/<ROM file name>.movie when there is one\n\
+              --json <file>                  Write the results\n\
+              --compare <file>               Exit with 1 on a regression against a --json file\n\
+              --threshold <percent>          Slowdown --compare allows (default 10)\n\
+              --scroll [-c <calls>]          Time the scroll kernels\n\
+              --state [-c <calls>]           Time save states\n\
+              --rewind                       Time the rewind buffer\n\
+              --opcodes [-c <cycles>] [--out <dir>]  ns per instruction of every core\n\
+              -h,  --help                    Print this\n";
+
+int main(int argc, char* argv[]){
+
+  uint64_t cycles = 2000000;
+  uint64_t frames = 3600;
+  unsigned int ticks_in_sec = 60 * 500;
+  std::string movie_dir, json_file, compare_file;
+  double threshold = 10;
+  Chip8::Core core = Chip8::Core::Table;
+  std::string aot_dir = "aot";
+  struct Chip8::Quirks quirks;
+  std::vector<std::string> dirs;
+  bool scroll = false, state = false, rewind = false, opcodes = false;
+  std::string out_dir;
+
+  std::vector<std::string> args(argv, argv+argc);
+  for(unsigned int i = 1; i < args.size(); i++) {
+    if((args[i] == "-c") || (args[i] == "--cycles")) {
+      cycles = std::stoull(args.at(i + 1));
+      i++;
+    }
+    else if((args[i] == "-f") || (args[i] == "--frames")) {
+      frames = std::stoull(args.at(i + 1));
+      i++;
+    }
+    else if((args[i] == "-t") || (args[i] == "--ticks")) {
+      ticks_in_sec = std::stoul(args.at(i + 1));
+      if(ticks_in_sec < 60) {
+        std::cerr << "Invalid ticks number, must be at least 60" << '\n';
+        return -1;
+      }
+      i++;
+    }
+    else if(args[i] == "--movies") {
+      movie_dir = args.at(i + 1);
+      i++;
+    }
+    else if(args[i] == "--json") {
+      json_file = args.at(i + 1);
+      i++;
+    }
+    else if(args[i] == "--compare") {
+      compare_file = args.at(i + 1);
+      i++;
+    }
+    else if(args[i] == "--threshold") {
+      threshold = std::stod(args.at(i + 1));
+      i++;
+    }
+    else if(args[i] == "--core") {
+      if(!Chip8::ParseCore(args.at(i + 1), core)) {
+        std::cerr << "Unknown core: " << args[i + 1] << '\n';
+        return -1;
+      }
+      i++;
+    }
+    else if((args[i] == "-q") || (args[i] == "--quirks")) {
+      if(!Chip8::ParseQuirks(args.at(i + 1), quirks)) {
+        std::cerr << "Unknown quirks: " << args[i + 1] << '\n';
+        return -1;
+      }
+      i++;
+    }
+    else if(args[i] == "--scroll") scroll = true;
+    else if(args[i] == "--state") state = true;
+    else if(args[i] == "--rewind") rewind = true;
+    else if(args[i] == "--opcodes") opcodes = true;
+    else if(args[i] == "--out") {
+      out_dir = args.at(i + 1);
+      i++;
+    }
+    else if(args[i] == "--aot-dir") {
+      aot_dir = args.at(i + 1);
+      i++;
+    }
+    else if((args[i] == "-h") || (args[i] == "--help")) {
+      fputs(USAGE, stdout);
+      return 0;
+    }
+    else if(args[i][0] == '-') {
+      std::cerr << "Invalid argument: " << args[i] << '\n' << USAGE;
+      return -1;
+    }
+    else dirs.push_back(args[i]);
+  }
+  if(scroll) return ScrollBench(cycles);
+  if(opcodes) return OpcodeBench(cycles, out_dir, aot_dir);
+  if(dirs.empty()) dirs = {"ROMS", "c8games", "sROMS"};
+
+  std::vector<std::string> roms;
+  for(auto &dir : dirs) {
+    if(!std::filesystem::is_directory(dir)) continue;
+    for(auto &entry : std::filesystem::directory_iterator(dir)) {
+      if(!entry.is_regular_file() || entry.path().filename() == "Makefile") continue;
+      roms.push_back(entry.path().string());
+    }
+  }
+  std::sort(roms.begin(), roms.end());
+
+  if(state) {
+    StateBench(roms, cycles);
+    return 0;
+  }
+  if(rewind) {
+    RewindBench(roms);
+    return 0;
+  }
+
+  const char *core_names[] = { "table", "threaded", "jit", "aot" };
+  unsigned int cycles_per_frame = ticks_in_sec / 60;
+  BenchConfig config;
+  config.core = core_names[(int)core];
+  config.frames = frames;
+  config.cycles_per_frame = cycles_per_frame;
+  config.quirks = QuirksName(quirks);
+
+  // every ROM would look changed against another setup
+  BenchConfig base_config;
+  std::vector<RomResult> baseline;
+  std::string error;
+  if(!compare_file.empty() && !ReadJson(compare_file.c_str(), base_config, baseline, error)) {
+    std::cerr << "Failed to read " << compare_file << ": " << error << '\n';
+    return -1;
+  }
+  std::string diff = compare_file.empty() ? "" : ConfigDiff(base_config, config);
+  if(!diff.empty()) {
+    std::cerr << compare_file << " was measured with another setup (" << diff << "), not comparable" << '\n';
+    return -1;
+  }
+
+  std::vector<RomResult> results;
+  double total_sec = 0;
+  uint64_t total_cycles = 0;
+  printf("%-50s %12s %12s %12s %12s  %s\n", "", "IPS", "ns/frame", "p50", "p99", "hash");
+
+  for(auto &rom : roms) {
+    Chip8 chip8;
+    chip8.SetQuirks(quirks);
+    if(!chip8.LoadRom(rom.c_str())) {
+      std::cerr << "Failed to load " << rom << '\n';
+      continue;
+    }
+    chip8.core = core;
+    chip8.cycles_per_frame = cycles_per_frame;
+    chip8.Seed(1);
+
+    std::string name = std::filesystem::path(rom).filename().string();
+    std::unique_ptr<Movie> movie;
+    std::string movie_file = movie_dir + "/" + name + ".movie";
+    if(!movie_dir.empty() && std::filesystem::exists(movie_file)) {
+      movie.reset(new Movie());
+      if(!movie->Load(movie_file.c_str()) || !movie->Start(chip8)) {
+        std::cerr << "Invalid movie for " << rom << ", using scripted input" << '\n';
+        movie.reset();
+      }
+    }
+
+    // after the movie, it may have changed quirks
+    if(core == Chip8::Core::Aot) {
+      std::string so = aot_dir + "/" + name + ".so";
+      if(!chip8.LoadAot(so.c_str())) std::cerr << "No compiled code for " << rom << ", interpreting" << '\n';
+    }
+
+    RomResult r = RunRom(chip8, rom, frames, movie.get());
+    total_sec += r.sec;
+    total_cycles += r.instructions;
+    printf("%-50s %12.0f %9.0f ns %9.0f ns %9.0f ns  %016llx\n", rom.c_str(),
+           r.Ips(), r.ns_per_frame, r.p50_ns, r.p99_ns, (unsigned long long)r.hash);
+    results.push_back(r);
+  }
+
+  if(total_sec > 0)
+    printf("%-50s %12.0f\n", "total", total_cycles / total_sec);
+
+  if(!json_file.empty() && !WriteJson(json_file.c_str(), results, config)) {
+    std::cerr << "Failed to write " << json_file << '\n';
+    return -1;
+  }
+  if(!compare_file.empty()) {
+    printf("\ncompared to %s:\n", compare_file.c_str());
+    if(Compare(results, baseline, threshold)) return 1;
+  }
+  return 0;
+}
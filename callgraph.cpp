@@ -0,0 +1,63 @@
+// Guest call graph, see callgraph.h.
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include "callgraph.h"
+
+void CallGraph::Clear(){
+  nodes.assign(1, Node{0, ROOT, 0, 0});
+  children.clear();
+  current = 0;
+  depth = 0;
+}
+
+uint32_t CallGraph::Child(uint32_t parent, uint16_t entry){
+  auto it = children.try_emplace((uint64_t)parent << 16 | entry, (uint32_t)nodes.size()).first;
+  if(it->second == nodes.size()) nodes.push_back(Node{parent, entry, 0, 0});
+  return it->second;
+}
+
+void CallGraph::Follow(uint32_t call_depth, uint16_t pc){
+
+  if(call_depth == depth + 1) {
+    if(depth < MAX_DEPTH) current = Child(current, pc & 0xFFF);
+  }
+  else if(call_depth + 1 == depth) {
+    if(depth <= MAX_DEPTH) current = nodes[current].parent;
+  }
+  else {
+    // a state was loaded or rewound, whatever called down to here is lost
+    current = 0;
+    for(uint32_t d = 0; d < std::min(call_depth, MAX_DEPTH); d++) current = Child(current, UNKNOWN);
+  }
+  depth = call_depth;
+}
+
+bool CallGraph::WriteCollapsed(const char *filename, Weight weight, unsigned int sample_interval) const{
+
+  std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(filename, "w"), fclose);
+  if(file == nullptr) return false;
+  FILE *f = file.get();
+
+  std::vector<uint32_t> chain;
+  std::string line;
+  for(uint32_t n = 0; n < nodes.size(); n++) {
+    uint64_t value = weight == Weight::Instructions ? nodes[n].instructions
+                                                    : nodes[n].sampled_ns * sample_interval;
+    if(value == 0) continue;
+
+    chain.clear();
+    for(uint32_t p = n; p != 0; p = nodes[p].parent) chain.push_back(p);
+    line = "main";
+    char name[16];
+    for(auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      uint16_t entry = nodes[*it].entry;
+      if(entry == UNKNOWN) snprintf(name, sizeof(name), ";?");
+      else snprintf(name, sizeof(name), ";sub_%03x", entry);
+      line += name;
+    }
+    fprintf(f, "%s %llu\n", line.c_str(), (unsigned long long)value);
+  }
+  return ferror(f) == 0;
+}
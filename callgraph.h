@@ -0,0 +1,60 @@
+#pragma once
+// Guest call graph. A shadow stack follows 2NNN/00EE through call_depth and
+// every instruction is counted in the subroutine it ran in, under the chain
+// of calls that led there (a calling context tree). Written as collapsed
+// stacks, "main;sub_2a4;sub_3b0 1234" a line, which is what flamegraph.pl,
+// inferno and speedscope read.
+// Host time is the sampled instructions of OpcodeStats times the sample
+// interval, an estimate like the per opcode times.
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#include "chip8.h"
+
+class CallGraph {
+
+  public:
+    enum class Weight { Instructions, HostTime };
+
+    CallGraph() { Clear(); }
+
+    // before every instruction, with pc still at it. a call shows up as
+    // call_depth one higher than last time and pc at the subroutine
+    void Step(uint32_t call_depth, uint16_t pc) {
+      if(call_depth != depth) Follow(call_depth, pc);
+      nodes[current].instructions++;
+    }
+    // host time of the instruction Step was last called for
+    void AddTime(uint64_t ns) { nodes[current].sampled_ns += ns; }
+    void Clear();
+
+    // one line per call chain that ran anything, HostTime in ns
+    bool WriteCollapsed(const char *filename, Weight weight, unsigned int sample_interval) const;
+    size_t Nodes() const { return nodes.size(); }
+
+  private:
+    // deeper calls are counted in the subroutine at this depth, games that
+    // CALL without ever returning would grow the tree forever otherwise
+    static constexpr uint32_t MAX_DEPTH = Chip8::STACK_SIZE;
+    static const uint16_t ROOT = 0xFFFF;
+    // frames of a call_depth that jumped, after a state was loaded
+    static const uint16_t UNKNOWN = 0xFFFE;
+
+    struct Node {
+      uint32_t parent;
+      uint16_t entry;        // subroutine address, ROOT or UNKNOWN
+      uint64_t instructions;
+      uint64_t sampled_ns;
+    };
+    // node 0 is the root, outside of any call
+    std::vector<Node> nodes;
+    // parent << 16 | entry -> node
+    std::unordered_map<uint64_t, uint32_t> children;
+    uint32_t current = 0;
+    // the call_depth the shadow stack is at, only MAX_DEPTH of it has nodes
+    uint32_t depth = 0;
+
+    void Follow(uint32_t call_depth, uint16_t pc);
+    uint32_t Child(uint32_t parent, uint16_t entry);
+};
@@ -1,179 +1,60 @@
 #include <cstdio>
 #include <stdint.h>
 #include <cstring>
+#include <iostream>
+#include <string>
+#include <sstream>
 #include <memory>
 #include <cstdlib>
 #include <vector>
-#include <stack>
 #include <time.h>
 #include <filesystem>
-#include <chrono>
 #include <algorithm>
-// beep sound
-#include <linux/input.h>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+// ahead of time compiled ROMs
+#include <dlfcn.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include "beep.cpp"
-
-class Chip8 {
-  public:
-    Chip8();
-    ~Chip8(){
-      if(pcspkr){
-        ev.value = 0;
-        if(write(speaker, &ev, sizeof(struct input_event)) < 0){
-            printf("cant speak");
-        } 
-      }
-    };
-    void MainLoop();
-    bool LoadRom(const char * filename);
-    void Reset();
-    void InitOpcodeTable();
-    void DebugRender();
-    //void SChipExtend();
-    
-    uint8_t memory[4096];
-    // registers
-    uint8_t V[16];
-    // store memory address
-    uint16_t I;
-    // program counter
-    uint16_t pc; 
-
-    std::vector<uint8_t> screen;
-    uint8_t screen_width, screen_height;
-
-    bool key_pressed[16];
-    int last_key_pressed;
-    bool redraw_screen;
-
-    typedef union {
-      // bits are read from the end
-      // N = last 4 bits
-      // we use Big-endian, so N is the lowest 4 bits of the instruction
-      // [first_semibit, X, Y, N] 16bits
-      struct {
-        uint16_t N : 4;
-        uint16_t Y : 4;
-        uint16_t X : 4;
-        uint16_t HB : 4; //Highest Bit
-      };
-
-      uint16_t NNN : 12;
-      uint16_t NN : 8;  
-      
-      uint16_t value;
-    } Args;
+#include "chip8.h"
 
-    std::string curr_opcode = "";
-    bool disas = false;
-    bool is_extended = false;
-    bool pcspkr = false;
 
-    struct Quirks {
-      bool jump = false;
-      bool shift = false;
-      bool clip_sprite = false;
-    } Quirks;
+// every handler in opcode_table, used to generate the threaded core labels.
+// quirk dependent handlers take their instantiation from the policy Q in scope
+#define CHIP8_OPCODES(OP) \
+  OP(0NNN, Opcode0NNN) OP(00E0, Opcode00E0) OP(00EE, Opcode00EE) OP(1NNN, Opcode1NNN) \
+  OP(2NNN, Opcode2NNN) OP(3XNN, Opcode3XNN) OP(4XNN, Opcode4XNN) OP(5XY0, Opcode5XY0) \
+  OP(6XNN, Opcode6XNN) OP(7XNN, Opcode7XNN) OP(8XY0, Opcode8XY0) OP(8XY1, Opcode8XY1) \
+  OP(8XY2, Opcode8XY2) OP(8XY3, Opcode8XY3) OP(8XY4, Opcode8XY4) OP(8XY5, Opcode8XY5) \
+  OP(8XY6, Opcode8XY6<Q::shift>) OP(8XY7, Opcode8XY7) OP(8XYE, Opcode8XYE<Q::shift>) \
+  OP(9XY0, Opcode9XY0) OP(ANNN, OpcodeANNN) OP(BNNN, OpcodeBNNN<Q::jump>) \
+  OP(CXNN, OpcodeCXNN) OP(DXYN, OpcodeDXYN<Q::clip_sprite>) OP(EX9E, OpcodeEX9E) \
+  OP(EXA1, OpcodeEXA1) OP(FX07, OpcodeFX07) OP(FX0A, OpcodeFX0A) OP(FX15, OpcodeFX15) \
+  OP(FX18, OpcodeFX18) OP(FX1E, OpcodeFX1E) OP(FX29, OpcodeFX29) OP(FX33, OpcodeFX33) \
+  OP(FX55, OpcodeFX55) OP(FX65, OpcodeFX65) OP(00CN, Opcode00CN) OP(00FB, Opcode00FB) \
+  OP(00FC, Opcode00FC) OP(00FD, Opcode00FD) OP(00FE, Opcode00FE) OP(00FF, Opcode00FF) \
+  OP(FX30, OpcodeFX30) OP(FX75, OpcodeFX75) OP(FX85, OpcodeFX85) OP(00DN, Opcode00DN)
 
-    struct Quirks quirks;
-    bool hires = false;
-    std::vector<int> breakpoints;
+#include "scroll.cpp"
+#include "rewind.cpp"
+#include "movie.cpp"
+#include "profile.cpp"
+#include "callgraph.cpp"
 
-  private:
- 
-    int X, Y;
-
-    struct OpcodeTableEntry {
-      uint16_t opcode;
-      uint16_t mask;
-      /*
-       A handle can be anything from an integer index to a pointer to a resource in kernel space. 
-       The idea is that they provide an abstraction of a resource, so you don't need to know much about the resource itself to use it.
-       
-       https://stackoverflow.com/questions/1303123/what-is-a-handle-in-c
-        
-       in this case we're calling associated opcode function
-      */
-      void (Chip8::*handler)(Args);
-      
-    };
+#if defined(__x86_64__)
+#include "jit.cpp"
+#endif
 
-    std::vector<OpcodeTableEntry> opcode_table;
-    std::stack<uint16_t> call_stack;
-    // schip
-    uint8_t rpl_flags[8];
 
-    uint16_t opcode;
-    uint8_t delay_timer;
-    uint8_t sound_timer;
-    bool sound_timer_is_counting = false;
-   
-    struct input_event ev;
-    int speaker;
-    
-    Beep beep;
-
-    //std::chrono::steady_clock time_delay_timer;
-    std::chrono::time_point<std::chrono::_V2::steady_clock, std::chrono::duration<long int, std::ratio<1, 1000000000>>> time_delay_timer;
-    std::chrono::time_point<std::chrono::_V2::steady_clock, std::chrono::duration<long int, std::ratio<1, 1000000000>>> time_sound_timer;
-
-    void Opcode0NNN(Args args);
-    void Opcode00E0(Args args);
-    void Opcode00EE(Args args);
-    void Opcode1NNN(Args args);
-    void Opcode2NNN(Args args);
-    void Opcode3XNN(Args args);
-    void Opcode4XNN(Args args);
-    void Opcode5XY0(Args args);
-    void Opcode6XNN(Args args);
-    void Opcode7XNN(Args args);
-    void Opcode8XY0(Args args);
-    void Opcode8XY1(Args args);
-    void Opcode8XY2(Args args);
-    void Opcode8XY3(Args args);
-    void Opcode8XY4(Args args);
-    void Opcode8XY5(Args args);
-    void Opcode8XY6(Args args);
-    void Opcode8XY7(Args args);
-    void Opcode8XYE(Args args);
-    void Opcode9XY0(Args args);
-    void OpcodeANNN(Args args);
-    void OpcodeBNNN(Args args);
-    void OpcodeCXNN(Args args);
-    void OpcodeDXYN(Args args);
-    void OpcodeEX9E(Args args);
-    void OpcodeEXA1(Args args);
-    void OpcodeFX07(Args args);
-    void OpcodeFX0A(Args args);
-    void OpcodeFX15(Args args);
-    void OpcodeFX18(Args args);
-    void OpcodeFX1E(Args args);
-    void OpcodeFX29(Args args);
-    void OpcodeFX33(Args args);
-    void OpcodeFX55(Args args);
-    void OpcodeFX65(Args args);
-    //SChip
-    void Opcode00CN(Args args); 
-    void Opcode00FB(Args args);
-    void Opcode00FC(Args args);
-    void Opcode00FD(Args args);
-    void Opcode00FE(Args args);
-    void Opcode00FF(Args args);
-    void OpcodeFX30(Args args);
-    void OpcodeFX75(Args args);
-    void OpcodeFX85(Args args);
-
-    void Disassembly(Args args, uint16_t opcode);
-};
-
-
-    char SPKR_PATH[] = "/dev/input/by-path/platform-pcspkr-event-spkr";
+    std::vector<uint8_t> Chip8::decode_table;
+
 
   // every char is 5 bytes long
-  uint8_t fontset[80] ={ 
+  static uint8_t fontset[80] ={ 
       0xF0, 0x90, 0x90, 0x90, 0xF0, //0
       0x20, 0x60, 0x20, 0x20, 0x70, //1
       0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
@@ -193,7 +74,7 @@ class Chip8 {
   };
 
   
-  uint8_t fontset_extended[100] ={ 
+  static uint8_t fontset_extended[100] ={ 
       //0xF0, 0xF0, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0xF0, 0xF0, //0
       //0x20, 0x20, 0x60, 0x60, 0x20, 0x20, 0x20, 0x20, 0x70, 0x70, //1
       //0xF0, 0xF0, 0x10, 0x10, 0xF0, 0xF0, 0x80, 0x80, 0xF0, 0xF0, //2
@@ -224,7 +105,7 @@ class Chip8 {
     {
         for (int x = 0; x < screen_width - 1; x++)
         {
-            if (screen.at(x + y * screen_width) == 0)
+            if (!Pixel(x, y))
                 printf(" ");
             else
                 printf("O");
@@ -237,34 +118,38 @@ class Chip8 {
 
 
   Chip8::Chip8(){
+    icache.resize(4096);
     InitOpcodeTable();
     Reset();
   }
 
+  Chip8::~Chip8(){
+    if(aot_handle) dlclose(aot_handle);
+  }
+
   void Chip8::Reset(){
 
     // most programs written for the original system begin at memory location 512 (0x200)
     pc = 0x200;
     I = 0;
     opcode = 0;
-    delay_timer = 0;
-    sound_timer = 0;
-    sound_timer_is_counting = false;
-    time_delay_timer = std::chrono::steady_clock::now();
-
-    speaker = open(SPKR_PATH, O_RDWR);
-    ev.type = EV_SND;
-    ev.code = SND_TONE;
-    ev.value = 200;
-    
-    beep.Init();
-
-    //time_sound_timer = std::chrono::steady_clock::now();
+    call_depth = 0;
+    // 00EE with nothing on the stack returns to whatever is there, so it
+    // has to be the same every run
+    memset(call_stack, 0, sizeof(call_stack));
+    memset(rpl_flags, 0, sizeof(rpl_flags));
+    frame_cycles = 0;
+    frame_count = 0;
+    delay_timer_end = 0;
+    sound_timer_end = 0;
+    sound_playing = false;
     
     redraw_screen = false;
     last_key_pressed = -1;
    
-    screen.resize(2048);
+    memset(display, 0, sizeof(display));
+    dirty_rows = ~0ull;
+    hires = false;
     screen_width = 64;
     screen_height = 32;
 
@@ -276,11 +161,149 @@ class Chip8 {
     }
 
     memset(memory, 0, 4096 * sizeof(memory[0]));
+    InvalidateCode(0, 4096);
 
     for(i = 0; i < 80; i++) memory[i] = fontset[i];
     for(i = 0; i < 100; i++) memory[i + 80] = fontset_extended[i];
+    RestoreAotBlocks();
 
-    srand(time(NULL));
+    Seed(time(NULL));
+  }
+
+  void Chip8::Seed(uint32_t seed){
+    // xorshift gets stuck on 0
+    rng_state = seed ? seed : 0x9E3779B9;
+  }
+
+  uint64_t Chip8::ScreenHash() const {
+    uint64_t hash = 14695981039346656037ull;
+    for(int y = 0; y < screen_height; y++) {
+      for(int x = 0; x < screen_width; x++) {
+        hash ^= Pixel(x, y);
+        hash *= 1099511628211ull;
+      }
+    }
+    return hash;
+  }
+
+  static_assert(sizeof(Chip8::State::display) == sizeof(uint64_t) * 64 * Chip8::DISPLAY_ROW_WORDS,
+                "State::display has to match the packed display");
+
+  void Chip8::SaveState(State &out) const {
+
+    out.magic = STATE_MAGIC;
+    out.version = STATE_VERSION;
+    memcpy(out.memory, memory, sizeof(out.memory));
+    memcpy(out.V, V, sizeof(out.V));
+    out.I = I;
+    out.pc = pc;
+    memcpy(out.call_stack, call_stack, sizeof(out.call_stack));
+    out.call_depth = call_depth;
+    memcpy(out.display, display, sizeof(out.display));
+    memcpy(out.rpl_flags, rpl_flags, sizeof(out.rpl_flags));
+    out.hires = hires;
+    out.quirks = quirks.jump | quirks.shift << 1 | quirks.clip_sprite << 2;
+    out.sound_playing = sound_playing;
+    out.last_key_pressed = last_key_pressed;
+    for(int i = 0; i < 16; i++) out.key_pressed[i] = key_pressed[i];
+    out.rng_state = rng_state;
+    out.frame_cycles = frame_cycles;
+    out.frame_count = frame_count;
+    out.delay_timer_end = delay_timer_end;
+    out.sound_timer_end = sound_timer_end;
+    out.instructions = instructions;
+  }
+
+  bool Chip8::LoadState(const State &in){
+
+    if(in.magic != STATE_MAGIC || in.version != STATE_VERSION) return false;
+
+    struct Quirks q;
+    q.jump = in.quirks & 1;
+    q.shift = in.quirks & 2;
+    q.clip_sprite = in.quirks & 4;
+    if(q.jump != quirks.jump || q.shift != quirks.shift || q.clip_sprite != quirks.clip_sprite)
+      SetQuirks(q);
+
+    // usually only data changed since the snapshot, so decoded and
+    // compiled code is only dropped where memory differs
+    const int CHUNK = 64;
+    for(int addr = 0; addr < 4096; addr += CHUNK) {
+      if(memcmp(&memory[addr], &in.memory[addr], CHUNK) == 0) continue;
+      memcpy(&memory[addr], &in.memory[addr], CHUNK);
+      InvalidateCode(addr, CHUNK);
+    }
+    RestoreAotBlocks();
+
+    memcpy(V, in.V, sizeof(V));
+    I = in.I;
+    pc = in.pc;
+    memcpy(call_stack, in.call_stack, sizeof(call_stack));
+    call_depth = in.call_depth;
+    memcpy(display, in.display, sizeof(display));
+    memcpy(rpl_flags, in.rpl_flags, sizeof(rpl_flags));
+    hires = in.hires;
+    screen_width = hires ? 128 : 64;
+    screen_height = hires ? 64 : 32;
+    last_key_pressed = in.last_key_pressed;
+    for(int i = 0; i < 16; i++) key_pressed[i] = in.key_pressed[i];
+    rng_state = in.rng_state;
+    frame_cycles = in.frame_cycles;
+    frame_count = in.frame_count;
+    delay_timer_end = in.delay_timer_end;
+    sound_timer_end = in.sound_timer_end;
+    instructions = in.instructions;
+
+    if(audio && sound_playing != (bool)in.sound_playing) {
+      if(in.sound_playing) audio->Play();
+      else audio->Stop();
+    }
+    sound_playing = in.sound_playing;
+
+    dirty_rows = ~0ull;
+    redraw_screen = true;
+    return true;
+  }
+
+  void Chip8::SetKey(int key, bool pressed){
+    key_pressed[key & 0xF] = pressed;
+    if(pressed) last_key_pressed = key & 0xF;
+  }
+
+  void Chip8::SetQuirks(struct Quirks new_quirks){
+    quirks = new_quirks;
+    InitOpcodeTable();
+    // cached instructions and jit code hold handlers of the old quirks, aot
+    // code reads them through aot_ctx and stays
+    for(auto &instr : icache) instr.valid = false;
+#if defined(__x86_64__)
+    if(jit) jit->Invalidate(0, 4096);
+#endif
+  }
+
+  bool Chip8::ParseCore(const std::string &str, Core &out){
+    if(str == "table") out = Core::Table;
+    else if(str == "threaded") out = Core::Threaded;
+    else if(str == "jit") out = Core::Jit;
+    else if(str == "aot") out = Core::Aot;
+    else return false;
+    return true;
+  }
+
+  bool Chip8::ParseQuirks(const std::string &str, struct Quirks &out){
+    struct Quirks q;
+    std::stringstream ss(str);
+    std::string name;
+    while(std::getline(ss, name, ',')) {
+      if(name == "chip8" || name == "none") q.jump = q.shift = q.clip_sprite = false;
+      else if(name == "schip") q.jump = q.shift = q.clip_sprite = true;
+      else if(name == "jump") q.jump = true;
+      else if(name == "shift") q.shift = true;
+      else if(name == "clip") q.clip_sprite = true;
+      else return false;
+    }
+    out = q;
+    return true;
   }
 
   void Chip8::InitOpcodeTable() {
@@ -299,57 +322,79 @@ class Chip8 {
     */
 
     opcode_table = std::vector<OpcodeTableEntry> {
-      // opcode|mask|function pointer
+      // opcode|mask|function pointer|name
       // chip8
-      { 0x00E0, 0xFFFF, &Chip8::Opcode00E0 },
-      { 0x00EE, 0xFFFF, &Chip8::Opcode00EE },
+      { 0x00E0, 0xFFFF, &Chip8::Opcode00E0, "00E0" },
+      { 0x00EE, 0xFFFF, &Chip8::Opcode00EE, "00EE" },
       
       // Schip extension
-      { 0x00C0, 0xFFF0, &Chip8::Opcode00CN },
-      { 0x00FB, 0xFFFF, &Chip8::Opcode00FB },
-      { 0x00FC, 0xFFFF, &Chip8::Opcode00FC },
-      { 0x00FD, 0xFFFF, &Chip8::Opcode00FD },
-      { 0x00FE, 0xFFFF, &Chip8::Opcode00FE },
-      { 0x00FF, 0xFFFF, &Chip8::Opcode00FF }, 
+      { 0x00C0, 0xFFF0, &Chip8::Opcode00CN, "00CN" },
+      { 0x00FB, 0xFFFF, &Chip8::Opcode00FB, "00FB" },
+      { 0x00FC, 0xFFFF, &Chip8::Opcode00FC, "00FC" },
+      { 0x00FD, 0xFFFF, &Chip8::Opcode00FD, "00FD" },
+      { 0x00FE, 0xFFFF, &Chip8::Opcode00FE, "00FE" },
+      { 0x00FF, 0xFFFF, &Chip8::Opcode00FF, "00FF" }, 
+      // XO-chip
+      { 0x00D0, 0xFFF0, &Chip8::Opcode00DN, "00DN" },
       // chip8 continuation
-      { 0x0000, 0xF000, &Chip8::Opcode0NNN },
-      { 0x1000, 0xF000, &Chip8::Opcode1NNN },
-      { 0x2000, 0xF000, &Chip8::Opcode2NNN },
-      { 0x3000, 0xF000, &Chip8::Opcode3XNN },
-      { 0x4000, 0xF000, &Chip8::Opcode4XNN },
-      { 0x5000, 0xF00F, &Chip8::Opcode5XY0 },
-      { 0x6000, 0xF000, &Chip8::Opcode6XNN },
-      { 0x7000, 0xF000, &Chip8::Opcode7XNN },
-      { 0x8000, 0xF00F, &Chip8::Opcode8XY0 },
-      { 0x8001, 0xF00F, &Chip8::Opcode8XY1 },
-      { 0x8002, 0xF00F, &Chip8::Opcode8XY2 },
-      { 0x8003, 0xF00F, &Chip8::Opcode8XY3 },
-      { 0x8004, 0xF00F, &Chip8::Opcode8XY4 },
-      { 0x8005, 0xF00F, &Chip8::Opcode8XY5 },
-      { 0x8006, 0xF00F, &Chip8::Opcode8XY6 },
-      { 0x8007, 0xF00F, &Chip8::Opcode8XY7 },
-      { 0x800E, 0xF00F, &Chip8::Opcode8XYE },
-      { 0x9000, 0xF00F, &Chip8::Opcode9XY0 },
-      { 0xA000, 0xF000, &Chip8::OpcodeANNN },
-      { 0xB000, 0xF000, &Chip8::OpcodeBNNN },
-      { 0xC000, 0xF000, &Chip8::OpcodeCXNN },
-      { 0xD000, 0xF000, &Chip8::OpcodeDXYN },
-      { 0xE09E, 0xF0FF, &Chip8::OpcodeEX9E },
-      { 0xE0A1, 0xF0FF, &Chip8::OpcodeEXA1 },
-      { 0xF007, 0xF0FF, &Chip8::OpcodeFX07 },
-      { 0xF00A, 0xF0FF, &Chip8::OpcodeFX0A },
-      { 0xF015, 0xF0FF, &Chip8::OpcodeFX15 },
-      { 0xF018, 0xF0FF, &Chip8::OpcodeFX18 },
-      { 0xF01E, 0xF0FF, &Chip8::OpcodeFX1E },
-      { 0xF029, 0xF0FF, &Chip8::OpcodeFX29 },
-      { 0xF033, 0xF0FF, &Chip8::OpcodeFX33 },
-      { 0xF055, 0xF0FF, &Chip8::OpcodeFX55 },
-      { 0xF065, 0xF0FF, &Chip8::OpcodeFX65 },
+      { 0x0000, 0xF000, &Chip8::Opcode0NNN, "0NNN" },
+      { 0x1000, 0xF000, &Chip8::Opcode1NNN, "1NNN" },
+      { 0x2000, 0xF000, &Chip8::Opcode2NNN, "2NNN" },
+      { 0x3000, 0xF000, &Chip8::Opcode3XNN, "3XNN" },
+      { 0x4000, 0xF000, &Chip8::Opcode4XNN, "4XNN" },
+      { 0x5000, 0xF00F, &Chip8::Opcode5XY0, "5XY0" },
+      { 0x6000, 0xF000, &Chip8::Opcode6XNN, "6XNN" },
+      { 0x7000, 0xF000, &Chip8::Opcode7XNN, "7XNN" },
+      { 0x8000, 0xF00F, &Chip8::Opcode8XY0, "8XY0" },
+      { 0x8001, 0xF00F, &Chip8::Opcode8XY1, "8XY1" },
+      { 0x8002, 0xF00F, &Chip8::Opcode8XY2, "8XY2" },
+      { 0x8003, 0xF00F, &Chip8::Opcode8XY3, "8XY3" },
+      { 0x8004, 0xF00F, &Chip8::Opcode8XY4, "8XY4" },
+      { 0x8005, 0xF00F, &Chip8::Opcode8XY5, "8XY5" },
+      { 0x8006, 0xF00F, quirks.shift ? &Chip8::Opcode8XY6<true> : &Chip8::Opcode8XY6<false>, "8XY6" },
+      { 0x8007, 0xF00F, &Chip8::Opcode8XY7, "8XY7" },
+      { 0x800E, 0xF00F, quirks.shift ? &Chip8::Opcode8XYE<true> : &Chip8::Opcode8XYE<false>, "8XYE" },
+      { 0x9000, 0xF00F, &Chip8::Opcode9XY0, "9XY0" },
+      { 0xA000, 0xF000, &Chip8::OpcodeANNN, "ANNN" },
+      { 0xB000, 0xF000, quirks.jump ? &Chip8::OpcodeBNNN<true> : &Chip8::OpcodeBNNN<false>, "BNNN" },
+      { 0xC000, 0xF000, &Chip8::OpcodeCXNN, "CXNN" },
+      { 0xD000, 0xF000, quirks.clip_sprite ? &Chip8::OpcodeDXYN<true> : &Chip8::OpcodeDXYN<false>, "DXYN" },
+      { 0xE09E, 0xF0FF, &Chip8::OpcodeEX9E, "EX9E" },
+      { 0xE0A1, 0xF0FF, &Chip8::OpcodeEXA1, "EXA1" },
+      { 0xF007, 0xF0FF, &Chip8::OpcodeFX07, "FX07" },
+      { 0xF00A, 0xF0FF, &Chip8::OpcodeFX0A, "FX0A" },
+      { 0xF015, 0xF0FF, &Chip8::OpcodeFX15, "FX15" },
+      { 0xF018, 0xF0FF, &Chip8::OpcodeFX18, "FX18" },
+      { 0xF01E, 0xF0FF, &Chip8::OpcodeFX1E, "FX1E" },
+      { 0xF029, 0xF0FF, &Chip8::OpcodeFX29, "FX29" },
+      { 0xF033, 0xF0FF, &Chip8::OpcodeFX33, "FX33" },
+      { 0xF055, 0xF0FF, &Chip8::OpcodeFX55, "FX55" },
+      { 0xF065, 0xF0FF, &Chip8::OpcodeFX65, "FX65" },
       // schip continuation
-      { 0xF030, 0xF0FF, &Chip8::OpcodeFX30 },
-      { 0xF075, 0xF0FF, &Chip8::OpcodeFX75 },
-      { 0xF085, 0xF0FF, &Chip8::OpcodeFX85 },
+      { 0xF030, 0xF0FF, &Chip8::OpcodeFX30, "FX30" },
+      { 0xF075, 0xF0FF, &Chip8::OpcodeFX75, "FX75" },
+      { 0xF085, 0xF0FF, &Chip8::OpcodeFX85, "FX85" },
     };
+
+    /*
+    walking the table above for every instruction costs dozens of compares for
+    opcodes like DXYN or FX65, so resolve all 65536 opcodes once instead.
+    first matching entry wins, exactly like the old linear scan.
+    masks are the same whatever the quirks, so it's shared by every Chip8,
+    call_once because they may be made on different threads
+    */
+    static std::once_flag decode_once;
+    std::call_once(decode_once, [this]() {
+      decode_table.assign(0x10000, UNKNOWN_OPCODE);
+      for(uint32_t op = 0; op < 0x10000; op++) {
+        for(unsigned int i = 0; i < opcode_table.size(); i++) {
+          if((op & opcode_table[i].mask) == opcode_table[i].opcode) {
+            decode_table[op] = i;
+            break;
+          }
+        }
+      }
+    });
   }
   // "its usually not implemented this days"
   // however maybe make this optional?
@@ -357,34 +402,31 @@ class Chip8 {
 
   void Chip8::Opcode00E0(Args args) {
     
-    std::fill(screen.begin(), screen.end(), 0);
+    memset(display, 0, sizeof(display));
+    dirty_rows |= AllRows();
     redraw_screen = true;
   }
 
   // return from the subroutine;  
   void Chip8::Opcode00EE(Args args) {
   
-    if(call_stack.empty()) return;
+    if(call_depth == 0) return;
     
-    pc = call_stack.top();
-    call_stack.pop();
+    call_depth--;
+    pc = call_stack[call_depth % STACK_SIZE];
  }
 
   void Chip8::Opcode1NNN(Args args) {
     
-    if(quirks.jump) {
-      pc = args.NNN + V[args.X];
-    } 
-    else {
-      pc = args.NNN;
-    }
+    pc = args.NNN;
   }
  
   //call the subroutine
   //Instruction should first should push the current PC to the stack, so the subroutine can return later
   void Chip8::Opcode2NNN(Args args) {
 
-    call_stack.push(pc);
+    call_stack[call_depth % STACK_SIZE] = pc;
+    call_depth++;
     pc = args.NNN;
   }
   
@@ -451,9 +493,10 @@ class Chip8 {
   }
 
   //https://github.com/Chromatophore/HP48-Superchip/blob/master/investigations/quirk_shift.md
+  template<bool SHIFT>
   void Chip8::Opcode8XY6(Args args) {
-    // TODO optional or configurable
-    if(!quirks.shift)
+    // schip shifts Vx in place
+    if(!SHIFT)
       V[args.X] = V[args.Y]; 
     
     uint8_t bit = (V[args.X] & 1);
@@ -469,9 +512,9 @@ class Chip8 {
     V[0xf] = (temp >= 0);
   }
 
+  template<bool SHIFT>
   void Chip8::Opcode8XYE(Args args) {
-    // TODO optional or configurable
-    if(!quirks.shift)
+    if(!SHIFT)
       V[args.X] = V[args.Y];
     
     uint8_t bit = (V[args.X] & 128) >> 7;
@@ -489,100 +532,91 @@ class Chip8 {
     I = args.NNN;
   }
 
+  // https://github.com/Chromatophore/HP48-Superchip/blob/master/investigations/quirk_jump0.md
+  // schip reads it as BXNN and jumps to XNN + VX
+  template<bool JUMP>
   void Chip8::OpcodeBNNN(Args args) {
-    // TODO may be wrong implemented (?)
-    //pc = args.NNN + V[args.X];
   
-    pc = (args.NNN + V[0]) & 0xfff;
+    pc = (args.NNN + V[JUMP ? args.X : 0]) & 0xfff;
   }
   
-  // random
+  // random, xorshift32 so every instance has its own reproducible sequence
   void Chip8::OpcodeCXNN(Args args) {
 
-    V[args.X] = rand() & args.NN;
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    V[args.X] = (rng_state >> 8) & args.NN;
   }
   
 
+  // sprite row 'bits' wide (8 or 16, MSB is the leftmost pixel) placed at
+  // column x of a display row 'width' pixels wide, as the row's two words.
+  // whatever doesn't fit wraps around to the left edge or is cut off with 'clip'
+  static inline void PlaceSpriteRow(uint64_t sprite, int bits, int x, int width, bool clip, uint64_t out[2]){
+
+    uint64_t s = sprite << (64 - bits);
+
+    if(width == 64) {
+      out[0] = s >> x;
+      if(!clip && x + bits > 64) out[0] |= s << (64 - x);
+      out[1] = 0;
+    }
+    else if(x < 64) {
+      out[0] = s >> x;
+      out[1] = x ? s << (64 - x) : 0;
+    }
+    else {
+      out[0] = (!clip && x + bits > 128) ? s << (128 - x) : 0;
+      out[1] = s >> (x - 64);
+    }
+  }
+
+  template<bool CLIP>
   void Chip8::OpcodeDXYN(Args args) {   
     
     // x,y,n are the same for extended and non-extended mode
-    uint8_t n = args.N;
-    uint8_t x, y;
-    //x = V[args.X];
-    //y = V[args.Y];
-    x = V[args.X] % screen_width;
-    y = V[args.Y] % screen_height;
-    bool flipped = false;
+    int x = V[args.X] % screen_width;
+    int y = V[args.Y] % screen_height;
 
     // https://github.com/Chromatophore/HP48-Superchip/blob/master/investigations/quirk_16x.md
-    // seems like its not the original behaviour, at least for HP48
-
-    if(n == 0){
-
-      for(int i = 0; i < 32; i+=2, y++){ 
-        //https://github.com/Chromatophore/HP48-Superchip/blob/master/investigations/quirk_collide.md
-        //if(y > screen_height){ 
-        //  V[0xF] = y - screen_height;
-        //  break;
-       // }
-        for(int j = 0; j < 2; j++){
-
-          uint8_t pixel = memory[I + i + j];
-            
-          for(int k = 0; k < 8; k++) {
-            uint8_t bit = ((pixel << k) & 128);
-            if(x % screen_width + k + (j * 8) >= screen_width || ((y - (i<<1)) % screen_height) + (i<<1) >= screen_height) continue; 
-
-            if(bit && screen[(j * 8 + x + k) + y * screen_width]) {
-              flipped |= true;
-            }
-              
-              screen[(x + k + j * 8) % screen_width + y * screen_width] ^= bit;
-            }
-
-        
-        } 
+    // DXY0 draws a 16x16 sprite, it's always cut off at the edges
+    bool big = (args.N == 0);
+    int rows = big ? 16 : args.N;
+    int bits = big ? 16 : 8;
+    // wrap x and y in default chip8, with the clip quirk only the
+    // starting position wraps and whatever goes past the edge is cut off
+    bool clip = CLIP || big;
+
+    // whole sprite row is XORed at once, any bit set in both means
+    // a pixel got erased
+    //  http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#8xy3
+    uint64_t collision = 0;
+
+    for(int j = 0; j < rows; j++) {
+
+      int row_y = y + j;
+      if(row_y >= screen_height) {
+        if(clip) break;
+        row_y -= screen_height;
       }
-        V[0xF] = flipped;
-        redraw_screen = true;
-    }
-    
-
-    else {
-      // wrap x and y in default chip8
-      for(int j = 0;  j < n; j++, y++) {
-
-        // we need to wrap y around every time in order to
-        // do not exceed the height
-        // otherwise it may be glichy ;o
-        y %= screen_height;
-
-        uint8_t pixel = memory[I + j];
-        for(int k = 0; k < 8; k++) {
-          // bits are stored in Big-endian
-          // so read from left to right
-          uint8_t bit = ((pixel << k) & 128);
-          
-          if(bit && screen[x + k + y * screen_width]) {
-            flipped |= true;
-          }
 
-          //  Sprites are XORed onto the existing screen
-          //  If this causes any pixels to be erased, VF is set to 1, otherwise it is set to 0.
-          //  http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#8xy3
-          
-          // wrap around cause when pixel goes through x = 64 then y needs to stay the same, not
-          // be increased
-          screen[(x + k) % screen_width + y * screen_width] ^= bit;
-        }
+      uint16_t addr = I + j * (bits / 8);
+      uint64_t sprite = memory[addr & 0xFFF];
+      if(big) sprite = sprite << 8 | memory[(addr + 1) & 0xFFF];
 
-      }
-      
-      // if any bit is flipped
-      V[0xF] = flipped;
+      uint64_t pixels[2];
+      PlaceSpriteRow(sprite, bits, x, screen_width, clip, pixels);
 
-      redraw_screen = true;
+      uint64_t *row = &display[row_y * DISPLAY_ROW_WORDS];
+      collision |= (row[0] & pixels[0]) | (row[1] & pixels[1]);
+      row[0] ^= pixels[0];
+      row[1] ^= pixels[1];
+      dirty_rows |= 1ull << row_y;
     }
+
+    V[0xF] = (collision != 0);
+    redraw_screen = true;
   }
 
   void Chip8::OpcodeEX9E(Args args) {
@@ -609,56 +643,29 @@ class Chip8 {
     }
   }
   
-  void Chip8::OpcodeFX07(Args args) {
-
-    if(delay_timer > 0){
+  uint8_t Chip8::DelayTimer() const {
+    uint64_t now = CurrentFrame();
+    return (delay_timer_end > now) ? delay_timer_end - now : 0;
+  }
 
-      auto current_time = std::chrono::steady_clock::now();
-      auto delta_time = std::chrono::duration_cast<std::chrono::nanoseconds>(current_time-time_delay_timer).count();
-      
-      //printf("delta_time: %d\n", delta_time);
-      // 1 / 0.00000006 == 16666666 :)
-      if(delta_time > 16666666){
-        
-        time_delay_timer = current_time;
-        
-       // printf("delay timer1: %d\n", delay_timer);
-       // printf("delay_timer: %d\n", (int)delay_timer);
-       // printf("subst: %d\n", (int)(delta_time * 0.00000006));
-        delay_timer = std::max(0, (int)delay_timer - (int)(delta_time * 0.00000006));
-
-      // printf("delay_timer after sub: %d\n\n", delay_timer);    
-      }
-    }
-    
-    V[args.X] = delay_timer;
+  // timers only make sense on the virtual clock, so the jit and aot code
+  // leave FX07, FX15 and FX18 to the interpreter, where Fetch counts them
+  void Chip8::OpcodeFX07(Args args) {
+    V[args.X] = DelayTimer();
   }
   
   void Chip8::OpcodeFX15(Args args) {
-  
-    time_delay_timer = std::chrono::steady_clock::now();
-    delay_timer = V[args.X];
+    delay_timer_end = CurrentFrame() + V[args.X];
   }
 
+  // the tone stops in RunCycles, at the end of the run that reaches sound_timer_end
   void Chip8::OpcodeFX18(Args args) {
     
-    time_sound_timer = std::chrono::steady_clock::now();
-    sound_timer = V[args.X];
- 
-    if(sound_timer == 0) return;
-
-    ev.value = 200;
-    if(pcspkr){
-      if(write(speaker, &ev, sizeof(struct input_event)) < 0){
-        printf("cant speak");
-        throw 1;
-      }
-    }
-    else {
-      beep.Play();
-    }
-    sound_timer_is_counting = true;
+    sound_timer_end = CurrentFrame() + V[args.X];
+    if(V[args.X] == 0 || sound_playing) return;
 
+    if(audio) audio->Play();
+    sound_playing = true;
   }
 
   void Chip8::OpcodeFX1E(Args args) {
@@ -669,7 +676,10 @@ class Chip8 {
   void Chip8::OpcodeFX0A(Args args) {
     // wait until we any key is pressed
     // just repeat this opcode over and over
-    if(last_key_pressed == -1) pc -= 2;
+    if(last_key_pressed == -1) {
+      pc -= 2;
+      run_status = RunStatus::KeyWait;
+    }
     else V[args.X] = last_key_pressed;
   }
   
@@ -684,6 +694,7 @@ class Chip8 {
     memory[I] = V[args.X] / 100;
     memory[I + 1] = (V[args.X] / 10) % 10;
     memory[I + 2] = V[args.X] % 10;
+    InvalidateCode(I, 3);
   }
 
   //"However, modern interpreters (starting with CHIP48 and SUPER-CHIP in the early 90s) used a temporary variable
@@ -694,6 +705,7 @@ class Chip8 {
     for(int i = 0; i <= args.X; i++){
       memory[I + i] = V[i];
     }
+    InvalidateCode(I, args.X + 1);
   }
 
   void Chip8::OpcodeFX65(Args args) {
@@ -708,86 +720,63 @@ class Chip8 {
 
   void Chip8::Opcode00CN(Args args){
 
-    unsigned int lines = args.N * screen_width;
-    std::fill(screen.end() - lines, screen.end(), 0);
-    std::rotate(screen.rbegin(), screen.rbegin() + lines, screen.rend());
+    scroll->down(display, screen_height, std::min<int>(args.N, screen_height));
+    dirty_rows |= AllRows();
+    redraw_screen = true;
+  }
+
+  //Scroll display N lines up (XO-chip)
+  void Chip8::Opcode00DN(Args args){
+
+    scroll->up(display, screen_height, std::min<int>(args.N, screen_height));
+    dirty_rows |= AllRows();
+    redraw_screen = true;
   }
   
   
   //Scroll display 4 pixels right
   void Chip8::Opcode00FB(Args args){
     
-    for(int y = 0; y < screen_height; y++){
-      
-      uint16_t xline = y * screen_width;
-      // delete 4 bytes from the left  
-      for(int x = 0; x < 4; x++){
-        screen.at(xline + x) = 0;
-      }
-      // go through line and move screen to erased left
-      for(int x = 0; x < screen_width - 4; x++){
-        screen.at(xline + x) = screen.at(xline + x + 4); 
-      } 
-      // and erase the last 4 bytes
-      for(int x = screen_width - 4; x < screen_width; x++){
-        screen.at(xline + x) = 0;
-      }
-
-      //next line :)
-    }
- 
+    scroll->right(display, screen_height, hires);
+    dirty_rows |= AllRows();
     redraw_screen = true;
   }
     
   //Scroll display 4 pixels left
   void Chip8::Opcode00FC(Args args){
 
-    for(int y = 0; y < screen_height; y++){
-      
-      uint16_t xline = ((y + 1) * screen_width) - 1;
-      // delete 4 bytes from the right  
-      for(int x = 0; x < 4; x++){
-        screen.at(xline - x) = 0;
-      }
-      // go through line and move screen to erased right
-      for(int x = 0; x < screen_width - 4; x++){
-        screen.at(xline - x) = screen.at(xline - x - 4); 
-      } 
-      // and erase the first 4 bytes
-      for(int x = screen_width - 4; x < screen_width; x++){
-        screen.at(xline - x) = 0;
-      }
-
-      //next line :)
-    }
-
+    scroll->left(display, screen_height, hires);
+    dirty_rows |= AllRows();
     redraw_screen = true;
-  
   }
   
   //Exit CHIP interpreter
+  // exit, stay on it so the program can't run past it
   void Chip8::Opcode00FD(Args args){
-    //TODO flag that informes to close?
+    pc -= 2;
+    run_status = RunStatus::Exit;
   }
   
   //Disable hires
   void Chip8::Opcode00FE(Args args){
     //TODO test
-    screen.resize(64 * 32);
-    std::fill(screen.begin(), screen.end(), 0);
+    memset(display, 0, sizeof(display));
     screen_width = 64;
     screen_height = 32;
     hires = false;
+    dirty_rows = ~0ull;
+    redraw_screen = true;
   }
   
   //Enable extended screen mode for full-screen graphics
   void Chip8::Opcode00FF(Args args){
     //TODO test
-    screen.resize(128 * 64);
-    std::fill(screen.begin(), screen.end(), 0);
+    memset(display, 0, sizeof(display));
     screen_width = 128;
     screen_height = 64;
     hires = true;    
+    dirty_rows = ~0ull;
+    redraw_screen = true;
   }
   
   // 10 bytes font
@@ -806,64 +795,80 @@ class Chip8 {
       V[i] = rpl_flags[i];
   }
 
-  void Chip8::Disassembly(Args args, uint16_t opcode){
-    
-    printf("%04x ", opcode);
+  std::string Chip8::Mnemonic(uint16_t opcode) const {
+
+    uint8_t op = decode_table[opcode];
+    if(op == UNKNOWN_OPCODE || op >= opcode_table.size()) return "???";
+    Args args = DecodeArgs(opcode);
+    int x = args.X, y = args.Y;
+
+    char buf[32];
+    auto f = [&](const char *format, auto... values) {
+      snprintf(buf, sizeof(buf), format, values...);
+      return std::string(buf);
+    };
 
     // instruction names taken from http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#3.1
-    switch(opcode){
-
-
-      case 0x00E0: printf("CLS"); break; 
-      case 0x00EE: printf("RET"); break;
-      case 0x0000: printf("\x1B[91mMachine code not implemented\033[0m");break;
-      case 0x1000: printf("JP %03x", args.NNN); break;
-      case 0x2000: printf("CALL #%03x", args.NNN); break; 
-      case 0x3000: printf("SE Vx, #%02x", args.NN); break;
-      case 0x4000: printf("SNE Vx, #%02x", args.NN); break; 
-      case 0x5000: printf("SE Vx, Vy"); break;
-      case 0x6000: printf("LD Vx, #%02x", args.NN); break;
-      case 0x7000: printf("ADD Vx, #%02x", args.NN); break;
-      case 0x8000: printf("LD Vx, Vy"); break;
-      case 0x8001: printf("OR Vx, Vy"); break;
-      case 0x8002: printf("AND Vx, Vy"); break;
-      case 0x8003: printf("XOR Vx, Vy"); break;
+    switch(opcode_table[op].opcode){
+      case 0x00E0: return "CLS";
+      case 0x00EE: return "RET";
+      case 0x0000: return f("SYS #%03x", args.NNN);
+      case 0x1000: return f("JP #%03x", args.NNN);
+      case 0x2000: return f("CALL #%03x", args.NNN);
+      case 0x3000: return f("SE V%X, #%02x", x, args.NN);
+      case 0x4000: return f("SNE V%X, #%02x", x, args.NN);
+      case 0x5000: return f("SE V%X, V%X", x, y);
+      case 0x6000: return f("LD V%X, #%02x", x, args.NN);
+      case 0x7000: return f("ADD V%X, #%02x", x, args.NN);
+      case 0x8000: return f("LD V%X, V%X", x, y);
+      case 0x8001: return f("OR V%X, V%X", x, y);
+      case 0x8002: return f("AND V%X, V%X", x, y);
+      case 0x8003: return f("XOR V%X, V%X", x, y);
       // -S suffix means carry byte is set
-      case 0x8004: printf("ADDS Vx, Vy"); break;
-      case 0x8005: printf("SUBS Vx, Vy"); break;
+      case 0x8004: return f("ADDS V%X, V%X", x, y);
+      case 0x8005: return f("SUBS V%X, V%X", x, y);
       // "If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2."
-      case 0x8006: printf("SHR Vx, Vy"); break;
-      case 0x8007: printf("SUBNS Vx, Vy"); break;
-      case 0x800E: printf("SHL Vx, Vy"); break;
-      case 0x9000: printf("SNE Vx, Vy"); break;
-      case 0xA000: printf("LD I, #%03x", args.NNN); break;
-      case 0xB000: printf("JP %02x, %03x", V[0], args.NNN); break;
-      case 0xC000: printf("RND Vx, %02x", args.NN); break;
-      case 0xD000: printf("\x1B[91mDRW x:%02x, y:%02x, n:%01x\033[0m", V[args.X], V[args.Y], args.N); break;
-      case 0xE09E: printf("SKP %02x (pressed)", V[args.X]); break;
-      case 0xE0A1: printf("SKNP %02x (Not pressed)", V[args.X]); break;
-      case 0xF007: printf("LD Vx, %02x (DelayTimer)", delay_timer); break;
-      case 0xF00A: printf("LD Vx, %02x (KeyPressed)", last_key_pressed); break;
-      case 0xF015: printf("LD DelayTimer, %02x", V[args.X]); break;
-      case 0xF018: printf("LD SoundTimer, %02x", V[args.X]); break;
-      case 0xF01E: printf("ADD I, %02x", V[args.X]); break;
-      case 0xF029: printf("LD F, %02x (normal font)", V[args.X]); break;
-      case 0xF033: printf("LD B, %02x", V[args.X]); break;
-      case 0xF055: printf("LD [I], %02x", V[args.X]); break;
-      case 0xF065: printf("LD Vx, [I]"); break;
-    
-      // s-chip
-      case 0x00C0: printf("SCRL DWN #%02x", args.N); break;
-      case 0x00FB: printf("SCRL RIGHT"); break;
-      case 0x00FC: printf("SCRL LEFT"); break;
-      case 0x00FD: printf("EXIT"); break;
-      case 0x00FE: printf("EXTENDED MODE OFF"); break;
-      case 0x00FF: printf("EXTENDED MODE ON"); break;
-      case 0xF030: printf("LD F, %02x (extended font)", V[args.X]); break;
-      case 0xF075: printf("ST FLAG %02x", V[args.X]); break;
-      case 0xF085: printf("LD FLAG %02x", V[args.X]); break;
+      case 0x8006: return f("SHR V%X, V%X", x, y);
+      case 0x8007: return f("SUBNS V%X, V%X", x, y);
+      case 0x800E: return f("SHL V%X, V%X", x, y);
+      case 0x9000: return f("SNE V%X, V%X", x, y);
+      case 0xA000: return f("LD I, #%03x", args.NNN);
+      // BXNN jumps to XNN + VX with the jump quirk
+      case 0xB000: return quirks.jump ? f("JP V%X, #%03x", x, args.NNN) : f("JP V0, #%03x", args.NNN);
+      case 0xC000: return f("RND V%X, #%02x", x, args.NN);
+      case 0xD000: return f("DRW V%X, V%X, %d", x, y, args.N);
+      case 0xE09E: return f("SKP V%X", x);
+      case 0xE0A1: return f("SKNP V%X", x);
+      case 0xF007: return f("LD V%X, DT", x);
+      case 0xF00A: return f("LD V%X, K", x);
+      case 0xF015: return f("LD DT, V%X", x);
+      case 0xF018: return f("LD ST, V%X", x);
+      case 0xF01E: return f("ADD I, V%X", x);
+      case 0xF029: return f("LD F, V%X", x);
+      case 0xF033: return f("LD B, V%X", x);
+      case 0xF055: return f("LD [I], V%X", x);
+      case 0xF065: return f("LD V%X, [I]", x);
 
+      // s-chip
+      case 0x00C0: return f("SCD %d", args.N);
+      case 0x00D0: return f("SCU %d", args.N);
+      case 0x00FB: return "SCR";
+      case 0x00FC: return "SCL";
+      case 0x00FD: return "EXIT";
+      case 0x00FE: return "LOW";
+      case 0x00FF: return "HIGH";
+      case 0xF030: return f("LD HF, V%X", x);
+      case 0xF075: return f("LD R, V%X", x);
+      case 0xF085: return f("LD V%X, R", x);
     }
+    return "???";
+  }
+
+  void Chip8::Disassembly(Args args, uint16_t opcode){
+    
+    // executed instructions go to the terminal, draws stand out
+    if(opcode == 0xD000) printf("%04x \x1B[91m%s\033[0m", args.value, Mnemonic(args.value).c_str());
+    else printf("%04x %s", args.value, Mnemonic(args.value).c_str());
     X = args.X, Y = args.Y;
     printf(" X: %01x, Y: %01x", args.X, args.Y);
     printf("\n");
@@ -871,7 +876,6 @@ class Chip8 {
   
   
 
-
   //https://dev.krzaq.cc/post/you-dont-need-a-stateful-deleter-in-your-unique_ptr-usually/
   struct FileDeleter {
     void operator()(FILE* ptr) const {
@@ -888,7 +892,203 @@ class Chip8 {
       return false;
     }
 
-    return fread(&memory[0] + 512, 1, 4096 - 512, f.get()) > 0;  
+    uint8_t rom[4096 - 512];
+    size_t size = fread(rom, 1, sizeof(rom), f.get());
+    return LoadRom(rom, size);
+  }
+
+  bool Chip8::LoadRom(const uint8_t *data, size_t size){
+
+    if(size == 0) return false;
+    size = std::min(size, (size_t)(4096 - 512));
+
+    memcpy(memory + 512, data, size);
+    InvalidateCode(512, 4096 - 512);
+    RestoreAotBlocks();
+    return true;
+  }
+
+  bool Chip8::SaveState(const char *filename) const {
+
+    std::unique_ptr<State> state(new State);
+    SaveState(*state);
+
+    std::unique_ptr<FILE, FileDeleter> f;
+    f.reset(fopen(filename, "wb"));
+    if(f == nullptr) return false;
+    return fwrite(state.get(), sizeof(State), 1, f.get()) == 1;
+  }
+
+  bool Chip8::LoadState(const char *filename){
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size != sizeof(State)) {
+      close(fd);
+      return false;
+    }
+    void *map = mmap(nullptr, sizeof(State), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return false;
+
+    bool ok = LoadState(*(const State*)map);
+    munmap(map, sizeof(State));
+    return ok;
+  }
+
+  bool Chip8::WriteStats(const char *filename) const {
+
+    if(stats == nullptr) return false;
+    std::unique_ptr<FILE, FileDeleter> f;
+    f.reset(fopen(filename, "w"));
+    if(f == nullptr) return false;
+
+    std::vector<int> ops;
+    uint64_t total = 0;
+    for(int op = 0; op < 256; op++) {
+      if(stats->count[op] == 0) continue;
+      ops.push_back(op);
+      total += stats->count[op];
+    }
+    std::sort(ops.begin(), ops.end(), [&](int a, int b) { return stats->count[a] > stats->count[b]; });
+
+    // what a sample costs with an empty handler, subtracted from mean_ns.
+    // the histogram keeps the raw times
+    double overhead = 1e9;
+    for(int i = 0; i < 1000; i++) {
+      auto start = std::chrono::steady_clock::now();
+      overhead = std::min(overhead, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    fprintf(f.get(), "{\n  \"instructions\": %llu,\n  \"sample_interval\": %u,\n  \"clock_overhead_ns\": %.1f,\n"
+            "  \"histogram_bucket_ns\": [", (unsigned long long)total, stats->sample_interval, overhead);
+    for(int b = 0; b < OpcodeStats::BUCKETS; b++) fprintf(f.get(), "%s%llu", b ? ", " : "", b ? 1ull << b : 0ull);
+    fprintf(f.get(), "],\n  \"opcodes\": [\n");
+
+    for(size_t i = 0; i < ops.size(); i++) {
+      int op = ops[i];
+      const char *name = (op == UNKNOWN_OPCODE || op >= (int)opcode_table.size()) ? "unknown" : opcode_table[op].name;
+      fprintf(f.get(), "    {\"opcode\": \"%s\", \"count\": %llu, \"share\": %.6f", name,
+              (unsigned long long)stats->count[op], (double)stats->count[op] / total);
+      if(stats->sample_interval) {
+        uint64_t samples = stats->samples[op];
+        double mean = samples ? std::max(0.0, (double)stats->sampled_ns[op] / samples - overhead) : 0.0;
+        fprintf(f.get(), ", \"samples\": %llu, \"mean_ns\": %.1f, \"histogram\": [", (unsigned long long)samples, mean);
+        for(int b = 0; b < OpcodeStats::BUCKETS; b++)
+          fprintf(f.get(), "%s%llu", b ? ", " : "", (unsigned long long)stats->histogram[op][b]);
+        fprintf(f.get(), "]");
+      }
+      fprintf(f.get(), "}%s\n", i + 1 < ops.size() ? "," : "");
+    }
+    fprintf(f.get(), "  ]\n}\n");
+    return ferror(f.get()) == 0;
+  }
+
+  bool Chip8::LoadAot(const char * filename){
+
+    void *handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if(handle == nullptr) {
+      std::cerr << dlerror() << '\n';
+      return false;
+    }
+
+    int *version = (int*)dlsym(handle, "aot_abi_version");
+    const uint8_t *rom = (const uint8_t*)dlsym(handle, "aot_rom");
+    unsigned int *rom_size = (unsigned int*)dlsym(handle, "aot_rom_size");
+    const AotBlock *blocks = (const AotBlock*)dlsym(handle, "aot_blocks");
+    unsigned int *block_count = (unsigned int*)dlsym(handle, "aot_block_count");
+
+    // code is only valid for exactly the ROM it was compiled from
+    if(!version || *version != AOT_ABI_VERSION || !rom || !rom_size || !blocks || !block_count ||
+       *rom_size > 4096 - 512 || memcmp(rom, memory + 512, *rom_size) != 0) {
+      dlclose(handle);
+      return false;
+    }
+
+    if(aot_handle) dlclose(aot_handle);
+    aot_handle = handle;
+    aot_blocks = blocks;
+    aot_block_count = *block_count;
+    aot_rom = rom;
+    aot_rom_size = *rom_size;
+
+    aot_table.assign(4096, nullptr);
+    aot_owners.assign(4096, {});
+    for(unsigned int i = 0; i < aot_block_count; i++) {
+      const AotBlock &b = aot_blocks[i];
+      for(int a = b.start; a < b.end && a < 4096; a++) aot_owners[a].push_back(&b);
+    }
+    RestoreAotBlocks();
+
+    aot_ctx.chip8 = this;
+    aot_ctx.memory = memory;
+    aot_ctx.V = V;
+    aot_ctx.I = &I;
+    aot_ctx.pc = &pc;
+    aot_ctx.last_key_pressed = &last_key_pressed;
+    aot_ctx.quirk_shift = &quirks.shift;
+    aot_ctx.quirk_jump = &quirks.jump;
+    aot_ctx.key_wait = false;
+    aot_ctx.call_handler = &AotCallHandler;
+    return true;
+  }
+
+  void Chip8::RestoreAotBlocks(){
+    for(unsigned int i = 0; i < aot_block_count; i++) {
+      const AotBlock &b = aot_blocks[i];
+      if(aot_table[b.start] == &b) continue;
+
+      bool same = true;
+      for(int a = b.start; a < b.end && a < 4096 && same; a++) {
+        bool in_rom = a >= 512 && a < 512 + (int)aot_rom_size;
+        same = memory[a] == (in_rom ? aot_rom[a - 512] : 0);
+      }
+      if(same) aot_table[b.start] = &b;
+    }
+  }
+
+  void Chip8::AotCallHandler(void *chip8, uint32_t opcode){
+    Chip8 *c = (Chip8*)chip8;
+    (c->*c->opcode_table[decode_table[opcode]].handler)(DecodeArgs(opcode));
+  }
+
+  Chip8::Args Chip8::DecodeArgs(uint16_t opcode){
+    Args args;
+    args.value = opcode;
+    args.NNN = opcode & 0x0FFF;
+    args.NN = opcode & 0x00FF;
+    args.X = (opcode >> 8) & 0xF;
+    args.Y = (opcode >> 4) & 0xF;
+    args.N = opcode & 0xF;
+    args.HB = opcode >> 12;
+    return args;
+  }
+
+  void Chip8::DecodeInstr(uint16_t addr){
+    DecodedInstr &instr = icache[addr];
+    uint16_t opcode = memory[addr] << 8 | memory[addr + 1];
+
+    instr.args = DecodeArgs(opcode);
+    instr.op = decode_table[opcode];
+    instr.handler = (instr.op == UNKNOWN_OPCODE) ? nullptr : opcode_table[instr.op].handler;
+    instr.valid = true;
+  }
+
+  // instructions are 2 bytes long and may start at odd addresses,
+  // so the one starting right before the written range is stale too
+  void Chip8::InvalidateCode(uint16_t addr, uint16_t len){
+    for(int i = -1; i < len; i++)
+      icache[(addr + i) & 0xFFF].valid = false;
+
+#if defined(__x86_64__)
+    if(jit) jit->Invalidate(addr, len);
+#endif
+
+    if(aot_owners.empty()) return;
+    for(int i = -1; i < len; i++)
+      for(const AotBlock *b : aot_owners[(addr + i) & 0xFFF]) aot_table[b->start] = nullptr;
   }
 
 
@@ -912,17 +1112,24 @@ class Chip8 {
   }
 */
 
-  void Chip8::MainLoop(){
+  // everything that happens before an instruction is executed,
+  // returns nullptr if execution has to stop (breakpoint or bad pc)
+  inline Chip8::DecodedInstr *Chip8::Fetch(){
+
+    // the previous instruction asked to stop
+    if(run_status != RunStatus::Running) return nullptr;
 
     if (pc + 1 >= 4096) {
       printf("error: pc out of bound (%.4x)\n", pc);
-      return;
+      run_status = RunStatus::PcOutOfBounds;
+      return nullptr;
     }
 
 
-    // first byte, shift and add second byte
-    opcode = memory[pc] << 8;
-    opcode |= memory[pc + 1];
+    // fetch and decode only when the cached instruction is stale
+    DecodedInstr *instr = &icache[pc];
+    if(!instr->valid) DecodeInstr(pc);
+    opcode = instr->args.value;
     /*
     You should then immediately increment the PC by 2, to be ready to fetch the next opcode. 
     Some people do this during the “execute” stage, since some instructions will increment it by 2 more to skip an instruction, 
@@ -931,30 +1138,11 @@ class Chip8 {
     https://tobiasvl.github.io/blog/write-a-chip-8-emulator/#fetch
     */
    
-    if(sound_timer > 0 && sound_timer_is_counting) {
-    
-      sound_timer--;
-
-      if(sound_timer <= 0){
-        
-        if(pcspkr){
-          ev.value = 0;
-          if(write(speaker, &ev, sizeof(struct input_event)) < 0)
-            printf("cant speak");
-        }
-        else{
-          beep.Stop();
-        }
-        
-        sound_timer_is_counting = false;
-      }
-
-    }
-
   if(breakpoints.size() != 0){
       for(auto bp : breakpoints) 
         if(bp == pc){      
-          return;
+          run_status = RunStatus::Breakpoint;
+          return nullptr;
       }
     }
     
@@ -962,24 +1150,245 @@ class Chip8 {
 
 
     pc += 2;
-    Args args;
-    args.value = opcode;
-    
+    run_executed++;
+    return instr;
+  }
 
-    std::stringstream ss;
-    bool called = false; 
-  
-    for(const auto& entry : opcode_table) {
-      
-      if((opcode & entry.mask) == entry.opcode) {
-        //std::cout <<std::hex <<entry.mask <<"\t";
-        called = true;
-        auto handler = entry.handler;
-        // calling opcode through function pointer
-        (this->*handler)(args);
-        if(disas) Disassembly(args, entry.opcode);
-        break;
+  template<class S>
+  bool Chip8::Step(){
+
+    uint16_t addr = pc;
+    DecodedInstr *instr = Fetch();
+    if(instr == nullptr) return false;
+
+    if constexpr(S::count) {
+      stats->count[instr->op]++;
+      stats->address_count[addr & 0xFFF]++;
+      if(stats->calls) stats->calls->Step(call_depth, addr);
+    }
+
+    if(instr->handler == nullptr) {
+      std::cout << "\x1B[91munknown opcode: \033[0m" << std::hex << opcode << "\n";
+      return true;
+    }
+
+    if constexpr(S::sample) {
+      if(stats->until_sample == 0) {
+        stats->until_sample = stats->sample_interval - 1;
+        auto start = std::chrono::steady_clock::now();
+        (this->*instr->handler)(instr->args);
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stats->samples[instr->op]++;
+        stats->sampled_ns[instr->op] += ns;
+        int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+        stats->histogram[instr->op][std::min(bucket, OpcodeStats::BUCKETS - 1)]++;
+        if(stats->calls) stats->calls->AddTime(ns);
+        if(disas) Disassembly(instr->args, opcode_table[instr->op].opcode);
+        return true;
+      }
+      stats->until_sample--;
+    }
+
+    // calling opcode through function pointer
+    (this->*instr->handler)(instr->args);
+    if(disas) Disassembly(instr->args, opcode_table[instr->op].opcode);
+    return true;
+  }
+
+  template<class S>
+  uint64_t Chip8::RunInstrumented(uint64_t cycles){
+    uint64_t executed = 0;
+    while(executed < cycles && Step<S>()) executed++;
+    return executed;
+  }
+
+  void Chip8::MainLoop(){
+    Step();
+  }
+
+  Chip8::RunStatus Chip8::RunCycles(uint64_t cycles){
+
+    run_status = RunStatus::Running;
+    run_executed = 0;
+    uint64_t executed = RunCore(cycles);
+
+    instructions += executed;
+    frame_count += (frame_cycles + executed) / cycles_per_frame;
+    frame_cycles = (frame_cycles + executed) % cycles_per_frame;
+    // FX0A runs once a frame while it waits and the rest of the frame goes
+    // by idle, otherwise the timers would crawl at one frame every
+    // cycles_per_frame waits
+    if(run_status == RunStatus::KeyWait && frame_cycles) {
+      frame_count++;
+      frame_cycles = 0;
+    }
+
+    if(sound_playing && frame_count >= sound_timer_end) {
+      if(audio) audio->Stop();
+      sound_playing = false;
+    }
+    return run_status;
+  }
+
+  Chip8::RunStatus Chip8::RunUntilFrame(){
+    return RunUntilFrame(UINT64_MAX);
+  }
+
+  Chip8::RunStatus Chip8::RunUntilFrame(uint64_t cycles){
+
+    uint64_t left = (frame_cycles < cycles_per_frame) ? cycles_per_frame - frame_cycles : 0;
+    RunStatus status = RunCycles(std::min(left, cycles));
+    // the wait took the rest of the frame, run_status still says KeyWait
+    if(status == RunStatus::KeyWait) return RunStatus::FrameEnd;
+    if(status != RunStatus::Running) return status;
+    return (cycles >= left) ? RunStatus::FrameEnd : RunStatus::Running;
+  }
+
+  // returns how many instructions were executed before stopping
+  uint64_t Chip8::RunCore(uint64_t cycles){
+
+    if(stats) {
+      if(stats->sample_interval) return RunInstrumented<StatsPolicy<true, true>>(cycles);
+      return RunInstrumented<StatsPolicy<true, false>>(cycles);
+    }
+
+#if defined(__GNUC__)
+    if(core == Core::Threaded) {
+      switch(quirks.jump << 2 | quirks.shift << 1 | quirks.clip_sprite) {
+        case 0: return RunThreaded<QuirkPolicy<false, false, false>>(cycles);
+        case 1: return RunThreaded<QuirkPolicy<false, false, true>>(cycles);
+        case 2: return RunThreaded<QuirkPolicy<false, true, false>>(cycles);
+        case 3: return RunThreaded<QuirkPolicy<false, true, true>>(cycles);
+        case 4: return RunThreaded<QuirkPolicy<true, false, false>>(cycles);
+        case 5: return RunThreaded<QuirkPolicy<true, false, true>>(cycles);
+        case 6: return RunThreaded<QuirkPolicy<true, true, false>>(cycles);
+        case 7: return RunThreaded<QuirkPolicy<true, true, true>>(cycles);
+      }
+    }
+#endif
+#if defined(__x86_64__)
+    if(core == Core::Jit) return RunJit(cycles);
+#endif
+    if(core == Core::Aot && aot_handle) return RunAot(cycles);
+
+    uint64_t executed = 0;
+    while(executed < cycles && Step()) executed++;
+    return executed;
+  }
+
+#if defined(__GNUC__)
+  /*
+  direct threaded dispatch: every handler ends with its own copy of fetch and
+  an indirect jump to the next handler, so the branch predictor sees one
+  jump site per opcode instead of one shared member function pointer call.
+  https://gcc.gnu.org/onlinedocs/gcc/Labels-as-Values.html
+  */
+  template<class Q>
+  uint64_t Chip8::RunThreaded(uint64_t cycles){
+
+    // op index -> label, filled once per quirk policy by matching handlers of
+    // opcode_table, which holds the same instantiations as long as quirks match Q.
+    // labels only exist in here, so no call_once, the lock is only taken
+    // until it's filled
+    static void *dispatch[256];
+    static std::atomic<bool> dispatch_ready{false};
+    static std::mutex dispatch_lock;
+
+    if(!dispatch_ready.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(dispatch_lock);
+      if(!dispatch_ready.load(std::memory_order_relaxed)) {
+        for(auto &label : dispatch) label = &&op_unknown;
+
+        for(unsigned int i = 0; i < opcode_table.size(); i++) {
+          #define OP_LABEL(name, fn) \
+            if(opcode_table[i].handler == &Chip8::fn) dispatch[i] = &&op_##name;
+          CHIP8_OPCODES(OP_LABEL)
+          #undef OP_LABEL
+        }
+        dispatch_ready.store(true, std::memory_order_release);
+      }
+    }
+
+    uint64_t executed = 0;
+    DecodedInstr *instr;
+
+    #define DISPATCH() \
+      if(executed == cycles || (instr = Fetch()) == nullptr) return executed; \
+      executed++; \
+      goto *dispatch[instr->op];
+
+    DISPATCH();
+
+    #define OP_HANDLER(name, fn) \
+      op_##name: \
+        fn(instr->args); \
+        if(disas) Disassembly(instr->args, opcode_table[instr->op].opcode); \
+        DISPATCH();
+    CHIP8_OPCODES(OP_HANDLER)
+    #undef OP_HANDLER
+
+    op_unknown:
+      std::cout << "\x1B[91munknown opcode: \033[0m" << std::hex << opcode << "\n";
+      DISPATCH();
+
+    #undef DISPATCH
+  }
+#endif
+
+  uint64_t Chip8::RunAot(uint64_t cycles){
+
+    uint64_t executed = 0;
+    while(executed < cycles && run_status == RunStatus::Running) {
+
+      // same restrictions as the jit, see RunJit
+      const AotBlock *block = nullptr;
+      if(breakpoints.empty() && !disas && pc < 4096)
+        block = aot_table[pc];
+
+      if(block != nullptr && block->count <= cycles - executed) {
+        block->run(&aot_ctx);
+        executed += block->count;
+        run_executed += block->count;
+
+        if(aot_ctx.key_wait) {
+          aot_ctx.key_wait = false;
+          run_status = RunStatus::KeyWait;
+        }
+        continue;
+      }
+
+      if(!Step()) break;
+      executed++;
+    }
+    return executed;
+  }
+
+#if defined(__x86_64__)
+  uint64_t Chip8::RunJit(uint64_t cycles){
+
+    if(!jit) jit.reset(new Jit(this));
+
+    uint64_t executed = 0;
+    while(executed < cycles && run_status == RunStatus::Running) {
+
+      // breakpoints and disassembly are handled per instruction,
+      // so only the interpreter can run while they're active
+      void *block = nullptr;
+      if(breakpoints.empty() && !disas && pc + 1 < 4096)
+        block = jit->Lookup(pc);
+
+      if(block != nullptr) {
+        uint64_t left = cycles - executed;
+        uint64_t ran = left - jit->Enter(block, left);
+        executed += ran;
+        run_executed += ran;
+        if(ran > 0) continue;
       }
+
+      // block didn't fit into the budget or couldn't be compiled
+      if(!Step()) break;
+      executed++;
     }
-    if(!called) std::cout << "\x1B[91munknown opcode: \033[0m" << std::hex << opcode << "\n";
-}
+    return executed;
+  }
+#endif
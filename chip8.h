@@ -0,0 +1,360 @@
+#pragma once
+// CHIP-8/SCHIP interpreter core, built into libchip8core.a.
+// It doesn't touch any window, sound or input device, the frontend reads the
+// screen and feeds keys, sound goes to an AudioSink it provides.
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <vector>
+
+#include "aot.h"
+#include "scroll.h"
+
+class Jit;
+
+// where the sound timer plays its tone, e.g. Beep (beep.cpp) or PcSpeaker (pcspkr.cpp)
+class AudioSink {
+  public:
+    virtual ~AudioSink() {}
+    virtual void Play() = 0;
+    virtual void Stop() = 0;
+};
+
+class CallGraph;
+
+// executions and sampled host time per opcode_table entry and executions per
+// address, collected while Chip8::stats points at it. index 255 is unknown opcodes
+struct OpcodeStats {
+  static const int BUCKETS = 16;
+  uint64_t count[256] = {};
+  // every sample_interval-th instruction is timed, 0 only counts
+  unsigned int sample_interval = 0;
+  unsigned int until_sample = 0;
+  uint64_t samples[256] = {};
+  uint64_t sampled_ns[256] = {};
+  // bucket b counts samples that took [2^b, 2^(b+1)) ns, clock reads included
+  uint64_t histogram[256][BUCKETS] = {};
+  // executions per guest address, see profile.h
+  uint64_t address_count[4096] = {};
+  // instructions and sampled time per guest call chain too, when set
+  CallGraph *calls = nullptr;
+};
+
+// what Step collects, so the uninstrumented one compiles to the same code as before
+template<bool COUNT, bool SAMPLE>
+struct StatsPolicy {
+  static const bool count = COUNT;
+  static const bool sample = SAMPLE;
+};
+
+// quirks fixed at compile time, every combination gets its own
+// instantiation of the handlers that depend on them, see Chip8::SetQuirks
+template<bool JUMP, bool SHIFT, bool CLIP>
+struct QuirkPolicy {
+  static const bool jump = JUMP;
+  static const bool shift = SHIFT;
+  static const bool clip_sprite = CLIP;
+};
+
+class Chip8 {
+  friend class Jit;
+
+  public:
+    Chip8();
+    ~Chip8();
+    void MainLoop();
+
+    // why RunCycles/RunUntilFrame came back
+    enum class RunStatus : uint8_t {
+      Running,      // whole budget was executed
+      FrameEnd,     // RunUntilFrame only, the frame is complete
+      Breakpoint,   // pc is on a breakpoint
+      KeyWait,      // FX0A is waiting for a key, the rest of the frame is skipped
+      Exit,         // program executed 00FD
+      PcOutOfBounds
+    };
+    // executes up to 'cycles' instructions with the selected core,
+    // stops early on anything but Running
+    RunStatus RunCycles(uint64_t cycles);
+    // executes what's left of the current 60 Hz frame. a key wait ends the
+    // frame like running through it would, so that's FrameEnd too
+    RunStatus RunUntilFrame();
+    // same, but at most 'cycles' instructions, Running if the frame isn't over
+    RunStatus RunUntilFrame(uint64_t cycles);
+    unsigned int cycles_per_frame = 7;
+    // executed by RunCycles so far
+    uint64_t instructions = 0;
+    bool LoadRom(const char * filename);
+    // copies a ROM image to 0x200, anything past the end of memory is cut off
+    bool LoadRom(const uint8_t *data, size_t size);
+    // ROM compiled by chip8-aot, must be loaded after the same ROM
+    bool LoadAot(const char * filename);
+    void Reset();
+    // CXNN sequence, Reset seeds it with the current time
+    void Seed(uint32_t seed);
+
+    static const int STACK_SIZE = 256;
+    static const uint32_t STATE_MAGIC = 0x53384843; // "CH8S"
+    static const uint32_t STATE_VERSION = 1;
+    // the whole machine, fixed size and without pointers, so a save file is
+    // just this struct (host byte order) and can be mapped straight from disk.
+    // bump STATE_VERSION whenever it changes
+    struct State {
+      uint32_t magic;
+      uint32_t version;
+      uint8_t memory[4096];
+      uint8_t V[16];
+      uint16_t I, pc;
+      uint16_t call_stack[STACK_SIZE];
+      uint32_t call_depth;
+      uint64_t display[64 * 2];
+      uint8_t rpl_flags[8];
+      uint8_t hires;
+      uint8_t quirks; // jump | shift << 1 | clip_sprite << 2
+      uint8_t sound_playing;
+      int8_t last_key_pressed;
+      uint8_t key_pressed[16];
+      uint32_t rng_state;
+      uint32_t frame_cycles;
+      uint64_t frame_count;
+      uint64_t delay_timer_end, sound_timer_end;
+      uint64_t instructions;
+    };
+    // no allocation, cheap enough for every frame
+    void SaveState(State &out) const;
+    // false if it's from another version
+    bool LoadState(const State &in);
+    bool SaveState(const char *filename) const;
+    // maps the file instead of reading it
+    bool LoadState(const char *filename);
+    void InitOpcodeTable();
+    // assembly of one instruction word, e.g. "ADD V3, #01", as the current quirks run it
+    std::string Mnemonic(uint16_t opcode) const;
+    void DebugRender();
+    //void SChipExtend();
+    
+    uint8_t memory[4096];
+    // registers
+    uint8_t V[16];
+    // store memory address
+    uint16_t I;
+    // program counter
+    uint16_t pc; 
+
+    // 64x32 in lores, 128x64 in hires (SCHIP)
+    uint8_t screen_width, screen_height;
+    // display is packed one bit per pixel, every row is DISPLAY_ROW_WORDS
+    // words and the MSB of the first one is x = 0. lores only uses the first word
+    static const int DISPLAY_ROW_WORDS = 2;
+    const uint64_t *DisplayRow(int y) const { return &display[y * DISPLAY_ROW_WORDS]; }
+    bool Pixel(int x, int y) const { return (DisplayRow(y)[x >> 6] >> (63 - (x & 63))) & 1; }
+    // FNV-1a of the visible pixels, for comparing runs
+    uint64_t ScreenHash() const;
+
+    bool key_pressed[16];
+    int last_key_pressed;
+    // key is 0-F
+    void SetKey(int key, bool pressed);
+    bool redraw_screen;
+    // rows changed since the last call, bit y is row y
+    uint64_t TakeDirtyRows() { uint64_t rows = dirty_rows; dirty_rows = 0; return rows; }
+
+    // operands are extracted once, when the instruction is decoded
+    // [HB, X, Y, N] 16bits, Big-endian, so N is the lowest 4 bits of the instruction
+    typedef struct {
+      uint16_t value;
+      uint16_t NNN;
+      uint8_t NN;
+      uint8_t X;
+      uint8_t Y;
+      uint8_t N;
+      uint8_t HB; //Highest Bit
+    } Args;
+
+    // while set every core runs the instrumented table interpreter, compiled
+    // blocks have no handler boundaries to count at
+    OpcodeStats *stats = nullptr;
+    // stats as JSON, most executed first
+    bool WriteStats(const char *filename) const;
+
+    std::string curr_opcode = "";
+    bool disas = false;
+    bool is_extended = false;
+    // sound timer output, nullptr for silence
+    AudioSink *audio = nullptr;
+    // 00CN/00DN/00FB/00FC, fastest set for this cpu by default
+    const ScrollKernels *scroll = &BestScrollKernels();
+
+    struct Quirks {
+      bool jump = false;
+      bool shift = false;
+      bool clip_sprite = false;
+    };
+
+    // only change through SetQuirks, handlers are picked for them
+    struct Quirks quirks;
+    // switches handlers and drops everything decoded or compiled with the old ones
+    void SetQuirks(struct Quirks new_quirks);
+    // "chip8", "schip" or a comma separated list of jump,shift,clip
+    static bool ParseQuirks(const std::string &str, struct Quirks &out);
+    bool hires = false;
+    std::vector<int> breakpoints;
+
+    // Table calls handlers through opcode_table function pointers,
+    // Threaded jumps straight between handlers (needs gcc/clang labels as values),
+    // Jit translates basic blocks to x86-64 (see jit.cpp),
+    // Aot runs blocks loaded with LoadAot (see aot.cpp)
+    enum class Core { Table, Threaded, Jit, Aot };
+    Core core = Core::Table;
+    // "table", "threaded", "jit" or "aot"
+    static bool ParseCore(const std::string &str, Core &out);
+
+  private:
+ 
+    int X, Y;
+
+    struct OpcodeTableEntry {
+      uint16_t opcode;
+      uint16_t mask;
+      /*
+       A handle can be anything from an integer index to a pointer to a resource in kernel space. 
+       The idea is that they provide an abstraction of a resource, so you don't need to know much about the resource itself to use it.
+       
+       https://stackoverflow.com/questions/1303123/what-is-a-handle-in-c
+        
+       in this case we're calling associated opcode function
+      */
+      void (Chip8::*handler)(Args);
+      // e.g. "8XY4", for stats
+      const char *name;
+    };
+
+    std::vector<OpcodeTableEntry> opcode_table;
+    // index into opcode_table for every possible opcode, shared by all instances
+    static std::vector<uint8_t> decode_table;
+    static constexpr uint8_t UNKNOWN_OPCODE = 0xFF;
+
+    // predecoded instruction for every address, so the same code isn't
+    // fetched and decoded over and over again.
+    // entries are invalidated whenever memory they were decoded from changes
+    struct DecodedInstr {
+      void (Chip8::*handler)(Args);
+      Args args;
+      uint8_t op; // index into opcode_table
+      bool valid;
+    };
+    std::vector<DecodedInstr> icache;
+    // deeper calls overwrite the oldest return addresses
+    uint16_t call_stack[STACK_SIZE];
+    uint32_t call_depth = 0;
+    // schip
+    uint8_t rpl_flags[8];
+
+    uint64_t display[64 * DISPLAY_ROW_WORDS];
+    uint64_t dirty_rows;
+    uint64_t AllRows() const { return ~0ull >> (64 - screen_height); }
+
+    uint16_t opcode;
+    RunStatus run_status = RunStatus::Running;
+    // instructions executed in the current frame
+    unsigned int frame_cycles = 0;
+    // frames finished since Reset
+    uint64_t frame_count = 0;
+    // instructions executed by the RunCore that is running right now, counted
+    // by Fetch and by RunJit/RunAot for whole blocks
+    uint64_t run_executed = 0;
+
+    // timers count down once per frame of the virtual clock above, so they
+    // only store the frame they reach 0 in
+    uint64_t delay_timer_end = 0;
+    uint64_t sound_timer_end = 0;
+    bool sound_playing = false;
+    // frame of the instruction being executed (the last one Fetch counted)
+    uint64_t CurrentFrame() const {
+      return frame_count + (frame_cycles + run_executed - (run_executed > 0)) / cycles_per_frame;
+    }
+    uint8_t DelayTimer() const;
+   
+    uint32_t rng_state;
+
+    void Opcode0NNN(Args args);
+    void Opcode00E0(Args args);
+    void Opcode00EE(Args args);
+    void Opcode1NNN(Args args);
+    void Opcode2NNN(Args args);
+    void Opcode3XNN(Args args);
+    void Opcode4XNN(Args args);
+    void Opcode5XY0(Args args);
+    void Opcode6XNN(Args args);
+    void Opcode7XNN(Args args);
+    void Opcode8XY0(Args args);
+    void Opcode8XY1(Args args);
+    void Opcode8XY2(Args args);
+    void Opcode8XY3(Args args);
+    void Opcode8XY4(Args args);
+    void Opcode8XY5(Args args);
+    template<bool SHIFT> void Opcode8XY6(Args args);
+    void Opcode8XY7(Args args);
+    template<bool SHIFT> void Opcode8XYE(Args args);
+    void Opcode9XY0(Args args);
+    void OpcodeANNN(Args args);
+    template<bool JUMP> void OpcodeBNNN(Args args);
+    void OpcodeCXNN(Args args);
+    template<bool CLIP> void OpcodeDXYN(Args args);
+    void OpcodeEX9E(Args args);
+    void OpcodeEXA1(Args args);
+    void OpcodeFX07(Args args);
+    void OpcodeFX0A(Args args);
+    void OpcodeFX15(Args args);
+    void OpcodeFX18(Args args);
+    void OpcodeFX1E(Args args);
+    void OpcodeFX29(Args args);
+    void OpcodeFX33(Args args);
+    void OpcodeFX55(Args args);
+    void OpcodeFX65(Args args);
+    //SChip
+    void Opcode00CN(Args args); 
+    void Opcode00DN(Args args);
+    void Opcode00FB(Args args);
+    void Opcode00FC(Args args);
+    void Opcode00FD(Args args);
+    void Opcode00FE(Args args);
+    void Opcode00FF(Args args);
+    void OpcodeFX30(Args args);
+    void OpcodeFX75(Args args);
+    void OpcodeFX85(Args args);
+
+    void Disassembly(Args args, uint16_t opcode);
+
+    static Args DecodeArgs(uint16_t opcode);
+    void DecodeInstr(uint16_t addr);
+    void InvalidateCode(uint16_t addr, uint16_t len);
+
+    DecodedInstr *Fetch();
+    template<class S = StatsPolicy<false, false>> bool Step();
+    template<class S> uint64_t RunInstrumented(uint64_t cycles);
+    uint64_t RunCore(uint64_t cycles);
+    template<class Q> uint64_t RunThreaded(uint64_t cycles);
+
+    std::unique_ptr<Jit> jit;
+    uint64_t RunJit(uint64_t cycles);
+
+    void *aot_handle = nullptr;
+    AotContext aot_ctx;
+    const AotBlock *aot_blocks = nullptr;
+    unsigned int aot_block_count = 0;
+    // what chip8-aot compiled: the ROM at 0x200, zeros everywhere else
+    const uint8_t *aot_rom = nullptr;
+    unsigned int aot_rom_size = 0;
+    // block starting at every address, nullptr if there's none or it's stale
+    std::vector<const AotBlock*> aot_table;
+    // blocks covering every address, so a store only looks at the ones it hits
+    std::vector<std::vector<const AotBlock*>> aot_owners;
+    // puts stale blocks back once memory holds their code again, after
+    // states, ROMs or a Reset replaced memory
+    void RestoreAotBlocks();
+    uint64_t RunAot(uint64_t cycles);
+    static void AotCallHandler(void *chip8, uint32_t opcode);
+};
@@ -0,0 +1,21 @@
+#version 430 core
+
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+// guest memory as 64x64 texels, address 0 top left and 64 bytes a row.
+// 0 is never executed, 1 is the hottest address
+uniform sampler2D heatTex;
+
+void main(){
+
+  ivec2 cell = min(ivec2(TexCoord * 64.0), ivec2(63, 63));
+  float heat = texelFetch(heatTex, cell, 0).r;
+  if(heat <= 0.0) discard;
+
+  // blue -> red -> yellow
+  vec3 color = heat < 0.5 ? mix(vec3(0.1, 0.2, 1.0), vec3(1.0, 0.1, 0.1), heat * 2.0)
+                          : mix(vec3(1.0, 0.1, 0.1), vec3(1.0, 1.0, 0.2), heat * 2.0 - 1.0);
+  FragColor = vec4(color, 0.35 + 0.5 * heat);
+}
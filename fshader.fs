@@ -4,9 +4,19 @@ out vec4 FragColor;
 
 in vec2 TexCoord;
 
-uniform sampler2D myTex;
+// packed display rows, see Chip8::display
+uniform usampler2D myTex;
+uniform int screenWidth;
+uniform int screenHeight;
 
 void main(){
 
-  FragColor = texture(myTex, TexCoord);
+  ivec2 pixel = min(ivec2(TexCoord * vec2(screenWidth, screenHeight)), ivec2(screenWidth - 1, screenHeight - 1));
+  // rows are 64 bit words with the MSB as the leftmost pixel, stored little
+  // endian, so the high half of a word is the texel that comes first on screen
+  int texel = (pixel.x >> 6) * 2 + (((pixel.x >> 5) & 1) ^ 1);
+  uint bits = texelFetch(myTex, ivec2(texel, pixel.y), 0).r;
+  float on = float((bits >> (31 - (pixel.x & 31))) & 1u);
+
+  FragColor = vec4(on, on, on, 1.0);
 }
@@ -0,0 +1,242 @@
+// Runs a ROM as fast as possible without window, audio or input and prints
+// where it ended up. Only needs libchip8core.a.
+//
+// Usage: ./chip8-headless [options...] <ROM file>
+//        stops on 00FD, a breakpoint, pc out of bounds or when a budget runs out.
+//        without -c/-f/--time it runs 10000000 instructions, or a whole movie with --play
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "chip8.h"
+#include "movie.h"
+#include "profile.h"
+#include "callgraph.h"
+
+const char *StatusName(Chip8::RunStatus status){
+  switch(status) {
+    case Chip8::RunStatus::Running: return "budget";
+    case Chip8::RunStatus::FrameEnd: return "budget";
+    case Chip8::RunStatus::Breakpoint: return "breakpoint";
+    case Chip8::RunStatus::KeyWait: return "key wait";
+    case Chip8::RunStatus::Exit: return "exit";
+    case Chip8::RunStatus::PcOutOfBounds: return "pc out of bounds";
+  }
+  return "";
+}
+
+int main(int argc, char* argv[]){
+
+  if(argc < 2 || std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+    puts("Usage: ./chip8-headless [options...] <file>\n\
+              -c,  --cycles <num>            Stop after this many instructions\n\
+              -f,  --frames <num>            Stop after this many 60 Hz frames\n\
+              --time <sec>                   Stop after this many seconds\n\
+              -t,  --ticks <num>             Ticks per second, sets instructions per frame (default 420)\n\
+              -q,  --quirks <list>           Comma separated quirks. Available: chip8, schip, jump, shift, clip\n\
+              -b,  --breakpoint <addr in hex>Stop on a particular address\n\
+              --seed <num>                   Seed of the CXNN random numbers (default 1)\n\
+              --core <name>                  Interpreter core. Available: table, threaded, jit, aot\n\
+              --aot <file>                   Load ROM compiled by chip8-aot (implies --core aot)\n\
+              --play <file>                  Feed input from a movie, sets quirks, ticks and seed\n\
+              --stats <file>                 Write executions per opcode as JSON (runs the table core)\n\
+              --stats-sample <n>             Also time every n-th instruction for --stats\n\
+              --profile <file>               Write the hottest addresses and loops (runs the table core)\n\
+              --callgraph <file>             Write instructions per guest call chain as collapsed stacks\n\
+                                             for flame graph tools (runs the table core)\n\
+              --callgraph-time               Weigh --callgraph by sampled host ns instead, every 16th\n\
+                                             instruction unless --stats-sample says otherwise\n\
+              -h,  --help                    Print this\n\
+         ");
+    return argc < 2 ? -1 : 0;
+  }
+
+  Chip8 chip8;
+  uint64_t cycles = 0, frames = 0;
+  double time_limit = 0;
+  unsigned int ticks_in_sec = 60 * 7;
+  uint32_t seed = 1;
+  std::string aot_file;
+  std::string movie_file;
+  std::string stats_file;
+  std::string profile_file;
+  std::string callgraph_file;
+  CallGraph::Weight callgraph_weight = CallGraph::Weight::Instructions;
+  OpcodeStats stats;
+  CallGraph calls;
+
+  std::vector<std::string> args(argv, argv+argc);
+  for(int i = 1; i < argc - 1; i++) {
+    std::string arg = args[i];
+
+    if((arg == "-c") || (arg == "--cycles")) {
+      cycles = std::stoull(args.at(i + 1));
+      i++;
+    }
+    else if((arg == "-f") || (arg == "--frames")) {
+      frames = std::stoull(args.at(i + 1));
+      i++;
+    }
+    else if(arg == "--time") {
+      time_limit = std::stod(args.at(i + 1));
+      i++;
+    }
+    else if((arg == "-t") || (arg == "--ticks")) {
+      ticks_in_sec = std::stoul(args.at(i + 1));
+      if(ticks_in_sec < 1 || ticks_in_sec > 10000) {
+        std::cerr << "Invalid ticks number, must be between 1 and 10000" << '\n';
+        return -1;
+      }
+      i++;
+    }
+    else if((arg == "-q") || (arg == "--quirks")) {
+      struct Chip8::Quirks quirks;
+      if(!Chip8::ParseQuirks(args.at(i + 1), quirks)) {
+        std::cerr << "Invalid quirks, available: chip8, schip, jump, shift, clip" << '\n';
+        return -1;
+      }
+      chip8.SetQuirks(quirks);
+      i++;
+    }
+    else if((arg == "-b") || (arg == "--breakpoint")) {
+      chip8.breakpoints.push_back(std::stoi(args.at(i + 1), nullptr, 16));
+      i++;
+    }
+    else if(arg == "--seed") {
+      seed = std::stoul(args.at(i + 1));
+      i++;
+    }
+    else if(arg == "--core") {
+      if(!Chip8::ParseCore(args.at(i + 1), chip8.core)) {
+        std::cerr << "Invalid core, available: table, threaded, jit, aot" << '\n';
+        return -1;
+      }
+      i++;
+    }
+    else if(arg == "--aot") {
+      aot_file = args.at(i + 1);
+      chip8.core = Chip8::Core::Aot;
+      i++;
+    }
+    else if(arg == "--stats") {
+      stats_file = args.at(i + 1);
+      i++;
+    }
+    else if(arg == "--profile") {
+      profile_file = args.at(i + 1);
+      i++;
+    }
+    else if(arg == "--callgraph") {
+      callgraph_file = args.at(i + 1);
+      i++;
+    }
+    else if(arg == "--callgraph-time") callgraph_weight = CallGraph::Weight::HostTime;
+    else if(arg == "--stats-sample") {
+      stats.sample_interval = std::stoul(args.at(i + 1));
+      i++;
+    }
+    else if(arg == "--play") {
+      movie_file = args.at(i + 1);
+      i++;
+    }
+    else {
+      std::cerr << "Invalid argument: " << arg << '\n';
+      return -1;
+    }
+  }
+
+  if(cycles == 0 && frames == 0 && time_limit == 0 && movie_file.empty()) cycles = 10000000;
+
+  if(!chip8.LoadRom(argv[argc-1])) {
+    std::cerr << "Invalid ROM" << '\n';
+    return -1;
+  }
+  chip8.Seed(seed);
+  chip8.cycles_per_frame = std::max(1u, ticks_in_sec / 60);
+
+  Movie movie;
+  if(!movie_file.empty()) {
+    if(!movie.Load(movie_file.c_str())) {
+      std::cerr << "Invalid movie" << '\n';
+      return -1;
+    }
+    if(!movie.Start(chip8)) {
+      std::cerr << "The movie was recorded with another ROM" << '\n';
+      return -1;
+    }
+  }
+  // after the movie, it may have changed quirks
+  if(!aot_file.empty() && !chip8.LoadAot(aot_file.c_str())) {
+    std::cerr << "Invalid compiled ROM, it has to be made by chip8-aot from the same ROM" << '\n';
+    return -1;
+  }
+
+  if(!stats_file.empty() || !profile_file.empty() || !callgraph_file.empty()) chip8.stats = &stats;
+  if(!callgraph_file.empty()) {
+    stats.calls = &calls;
+    if(callgraph_weight == CallGraph::Weight::HostTime && stats.sample_interval == 0) stats.sample_interval = 16;
+  }
+
+  // time budget is checked between chunks
+  const uint64_t CHUNK = 1000000;
+  uint64_t frame = 0;
+  Chip8::RunStatus status = Chip8::RunStatus::Running;
+  auto start = std::chrono::steady_clock::now();
+  double sec = 0;
+
+  while(true) {
+    if(!movie_file.empty()) {
+      if(movie.Finished(chip8) || (frames && frame == frames)) break;
+      status = movie.RunUntilFrame(chip8);
+      if(status == Chip8::RunStatus::FrameEnd) {
+        status = Chip8::RunStatus::Running;
+        frame++;
+      }
+    }
+    else if(frames) {
+      if(frame == frames) break;
+      // nothing will ever press a key, but key waits still end frames
+      status = chip8.RunUntilFrame();
+      if(status == Chip8::RunStatus::FrameEnd) {
+        status = Chip8::RunStatus::Running;
+        frame++;
+      }
+    }
+    else {
+      uint64_t left = cycles ? cycles - chip8.instructions : CHUNK;
+      if(left == 0) break;
+      status = chip8.RunCycles(std::min(left, CHUNK));
+    }
+    if(status != Chip8::RunStatus::Running) break;
+    if(cycles && chip8.instructions >= cycles) break;
+
+    sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(time_limit && sec >= time_limit) break;
+  }
+  sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("stop:         %s\n", StatusName(status));
+  printf("pc:           %03x\n", chip8.pc);
+  printf("instructions: %llu\n", (unsigned long long)chip8.instructions);
+  if(frames || !movie_file.empty()) printf("frames:       %llu\n", (unsigned long long)frame);
+  printf("time:         %.3f s\n", sec);
+  printf("IPS:          %.0f\n", sec > 0 ? chip8.instructions / sec : 0);
+  printf("screen hash:  %016llx\n", (unsigned long long)chip8.ScreenHash());
+
+  if(!stats_file.empty() && !chip8.WriteStats(stats_file.c_str())) {
+    std::cerr << "Failed to write " << stats_file << '\n';
+    return -1;
+  }
+  if(!profile_file.empty() && !WriteProfile(profile_file.c_str(), chip8, stats)) {
+    std::cerr << "Failed to write " << profile_file << '\n';
+    return -1;
+  }
+  if(!callgraph_file.empty() && !calls.WriteCollapsed(callgraph_file.c_str(), callgraph_weight, stats.sample_interval)) {
+    std::cerr << "Failed to write " << callgraph_file << '\n';
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,513 @@
+// Basic block recompiler from CHIP-8 to x86-64.
+//
+// A block starts at some guest address and runs until a jump, call, return
+// or skip. Simple instructions (loads, ALU, I arithmetic, BCD, jumps, calls,
+// returns, skips) are translated to native code that works directly on the
+// Chip8 object held in rbx. Everything else calls the regular opcode handler.
+//
+// Blocks jump straight into each other through block_table, entries of
+// blocks that weren't compiled yet (or got invalidated) point to a stub that
+// returns to RunJit. Addresses the jit leaves to the interpreter (timer ops,
+// unknown opcodes) point to a copy of it, so they aren't compiled again.
+//
+// r12 holds the remaining cycle budget, every block checks that it still
+// fits before running, so the number of executed instructions is exactly
+// the same as in the interpreter.
+#include <sys/mman.h>
+#include <deque>
+
+class Jit {
+
+  public:
+    Jit(Chip8 *chip8);
+    ~Jit();
+    // returns native code of the block starting at addr, compiles it if needed
+    // nullptr if there's nothing to compile (e.g. unknown opcode)
+    void *Lookup(uint16_t addr);
+    // runs compiled code, returns how many cycles are left from budget
+    uint64_t Enter(void *block, uint64_t budget);
+    void Invalidate(uint16_t addr, uint16_t len);
+    void Flush();
+
+  private:
+    static const unsigned int CODE_SIZE = 4 * 1024 * 1024;
+    static const unsigned int MAX_BLOCK_INSTRS = 64;
+
+    Chip8 *chip8;
+    uint8_t *code;
+    unsigned int code_used;
+
+    uint8_t *enter_stub;
+    uint8_t *exit_stub;
+    // same code as exit_stub, marks block_table entries that compiled to nothing
+    uint8_t *interp_stub;
+
+    void *block_table[4096];
+    struct Block {
+      uint16_t start;
+      uint16_t end;
+    };
+    std::vector<Block> blocks;
+    // handler and args of every instruction that calls the interpreter, so
+    // the call doesn't decode again. a deque doesn't move them, cleared by Flush
+    std::deque<Chip8::DecodedInstr> decoded;
+    // guest bytes covered by any compiled block
+    bool covered[4096];
+
+    struct Chip8::Quirks quirks;
+    // offsets of guest state inside Chip8
+    int32_t off_V, off_I, off_pc, off_memory, off_last_key, off_status;
+    int32_t off_stack, off_depth;
+
+    uint8_t *Compile(uint16_t start);
+    void EmitStubs();
+
+    // x86-64 encoding helpers
+    void Emit8(uint8_t b) { code[code_used++] = b; }
+    void Emit16(uint16_t v) { memcpy(code + code_used, &v, 2); code_used += 2; }
+    void Emit32(uint32_t v) { memcpy(code + code_used, &v, 4); code_used += 4; }
+    void Emit64(uint64_t v) { memcpy(code + code_used, &v, 8); code_used += 8; }
+    // modrm + disp32 for [rbx + disp]
+    void EmitMem(uint8_t reg, int32_t disp) { Emit8(0x80 | (reg << 3) | 3); Emit32(disp); }
+    void EmitRel32(uint8_t *target) { Emit32((int32_t)(target - (code + code_used + 4))); }
+
+    int32_t Vx(int x) { return off_V + x; }
+    void EmitStoreImmPc(uint16_t pc);
+    void EmitStaticExit(uint16_t target);
+    void EmitDynamicExit();
+    void EmitCallHandler(uint16_t opcode);
+    void EmitCallInvalidate(uint8_t len);
+    void EmitExitIfInvalidated(uint8_t *block, uint16_t start, uint16_t next, unsigned int left);
+
+    static void CallHandler(Chip8 *chip8, const Chip8::DecodedInstr *instr);
+    static void CallInvalidate(Chip8 *chip8, uint32_t addr, uint32_t len);
+};
+
+
+Jit::Jit(Chip8 *chip8): chip8(chip8), code_used(0) {
+
+  code = (uint8_t*)mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(code == MAP_FAILED) {
+    code = nullptr;
+    std::cerr << "jit: couldn't allocate executable memory" << '\n';
+    return;
+  }
+
+  off_V = (uint8_t*)chip8->V - (uint8_t*)chip8;
+  off_I = (uint8_t*)&chip8->I - (uint8_t*)chip8;
+  off_pc = (uint8_t*)&chip8->pc - (uint8_t*)chip8;
+  off_memory = (uint8_t*)chip8->memory - (uint8_t*)chip8;
+  off_last_key = (uint8_t*)&chip8->last_key_pressed - (uint8_t*)chip8;
+  off_status = (uint8_t*)&chip8->run_status - (uint8_t*)chip8;
+  off_stack = (uint8_t*)chip8->call_stack - (uint8_t*)chip8;
+  off_depth = (uint8_t*)&chip8->call_depth - (uint8_t*)chip8;
+  // 2NNN/00EE index the stack with the low byte of call_depth
+  static_assert(Chip8::STACK_SIZE == 256, "call stack has to be 256 entries");
+
+  Flush();
+}
+
+Jit::~Jit(){
+  if(code) munmap(code, CODE_SIZE);
+}
+
+void Jit::Flush(){
+
+  code_used = 0;
+  blocks.clear();
+  decoded.clear();
+  memset(covered, 0, sizeof(covered));
+  quirks = chip8->quirks;
+
+  EmitStubs();
+  for(auto &entry : block_table) entry = exit_stub;
+}
+
+void Jit::EmitStubs(){
+
+  // enter_stub(chip8, block, budget, block_table) -> remaining budget
+  // 3 pushes keep the stack 16 byte aligned for handler calls
+  enter_stub = code + code_used;
+  Emit8(0x53);                          // push rbx
+  Emit8(0x41); Emit8(0x54);             // push r12
+  Emit8(0x41); Emit8(0x55);             // push r13
+  Emit8(0x48); Emit8(0x89); Emit8(0xFB); // mov rbx, rdi
+  Emit8(0x49); Emit8(0x89); Emit8(0xD4); // mov r12, rdx
+  Emit8(0x49); Emit8(0x89); Emit8(0xCD); // mov r13, rcx
+  Emit8(0xFF); Emit8(0xE6);             // jmp rsi
+
+  // pc is already stored by whoever jumps here
+  exit_stub = code + code_used;
+  Emit8(0x4C); Emit8(0x89); Emit8(0xE0); // mov rax, r12
+  Emit8(0x41); Emit8(0x5D);             // pop r13
+  Emit8(0x41); Emit8(0x5C);             // pop r12
+  Emit8(0x5B);                          // pop rbx
+  Emit8(0xC3);                          // ret
+
+  interp_stub = code + code_used;
+  for(uint8_t *b = exit_stub; b < interp_stub; b++) Emit8(*b);
+}
+
+uint64_t Jit::Enter(void *block, uint64_t budget){
+  typedef uint64_t (*EnterFn)(Chip8*, void*, uint64_t, void**);
+  return ((EnterFn)enter_stub)(chip8, block, budget, block_table);
+}
+
+void *Jit::Lookup(uint16_t addr){
+
+  if(code == nullptr) return nullptr;
+  if(block_table[addr] == interp_stub) return nullptr;
+  if(block_table[addr] != exit_stub) return block_table[addr];
+
+  // quirks are baked into the generated code
+  if(memcmp(&quirks, &chip8->quirks, sizeof(quirks)) != 0) Flush();
+  // worst case size of a block, start over when the buffer is full
+  if(code_used + MAX_BLOCK_INSTRS * 256 + 64 > CODE_SIZE) Flush();
+
+  uint8_t *block = Compile(addr);
+  if(block != nullptr) block_table[addr] = block;
+  else {
+    // remembered like a block of its one instruction, so a write over it
+    // gives the jit another try
+    block_table[addr] = interp_stub;
+    blocks.push_back({addr, (uint16_t)(addr + 2)});
+    covered[addr] = covered[addr + 1] = true;
+  }
+  return block;
+}
+
+void Jit::Invalidate(uint16_t addr, uint16_t len){
+
+  if(code == nullptr) return;
+
+  bool hit = false;
+  for(int i = -1; i < len && !hit; i++)
+    hit = covered[(addr + i) & 0xFFF];
+  if(!hit) return;
+
+  // blocks stay in the code buffer until the next flush, so a block that
+  // writes over itself can still safely run to its exit
+  int lo = addr - 1, hi = addr + len;
+  memset(covered, 0, sizeof(covered));
+  std::vector<Block> alive;
+  for(auto &b : blocks) {
+    if(b.start < hi && b.end > lo) {
+      block_table[b.start] = exit_stub;
+      continue;
+    }
+    alive.push_back(b);
+    for(int i = b.start; i < b.end; i++) covered[i] = true;
+  }
+  blocks.swap(alive);
+}
+
+void Jit::CallHandler(Chip8 *chip8, const Chip8::DecodedInstr *instr){
+  (chip8->*instr->handler)(instr->args);
+}
+
+void Jit::CallInvalidate(Chip8 *chip8, uint32_t addr, uint32_t len){
+  chip8->InvalidateCode(addr, len);
+}
+
+void Jit::EmitStoreImmPc(uint16_t pc){
+  Emit8(0x66); Emit8(0xC7); EmitMem(0, off_pc); Emit16(pc); // mov word [pc], imm16
+}
+
+void Jit::EmitStaticExit(uint16_t target){
+
+  EmitStoreImmPc(target);
+  if(target + 1 >= 4096) {
+    Emit8(0xE9); EmitRel32(exit_stub);                   // jmp exit_stub
+    return;
+  }
+  Emit8(0x41); Emit8(0xFF); Emit8(0xA5); Emit32(target * 8); // jmp [r13 + target*8]
+}
+
+// new pc is in eax
+void Jit::EmitDynamicExit(){
+  Emit8(0x66); Emit8(0x89); EmitMem(0, off_pc);          // mov [pc], ax
+  Emit8(0x3D); Emit32(4094);                             // cmp eax, 4094
+  Emit8(0x0F); Emit8(0x87); EmitRel32(exit_stub);        // ja exit_stub
+  Emit8(0x41); Emit8(0xFF); Emit8(0x64); Emit8(0xC5); Emit8(0x00); // jmp [r13 + rax*8]
+}
+
+void Jit::EmitCallHandler(uint16_t opcode){
+  uint8_t op = Chip8::decode_table[opcode];
+  decoded.push_back({chip8->opcode_table[op].handler, Chip8::DecodeArgs(opcode), op, true});
+  Emit8(0x48); Emit8(0x89); Emit8(0xDF);                 // mov rdi, rbx
+  Emit8(0x48); Emit8(0xBE); Emit64((uint64_t)&decoded.back()); // mov rsi, instr
+  Emit8(0x48); Emit8(0xB8); Emit64((uint64_t)&CallHandler); // mov rax, CallHandler
+  Emit8(0xFF); Emit8(0xD0);                              // call rax
+}
+
+// the written range is [I, I + len), I is in eax
+void Jit::EmitCallInvalidate(uint8_t len){
+  Emit8(0x48); Emit8(0x89); Emit8(0xDF);                 // mov rdi, rbx
+  Emit8(0x89); Emit8(0xC6);                              // mov esi, eax
+  Emit8(0xBA); Emit32(len);                              // mov edx, len
+  Emit8(0x48); Emit8(0xB8); Emit64((uint64_t)&CallInvalidate); // mov rax, CallInvalidate
+  Emit8(0xFF); Emit8(0xD0);                              // call rax
+}
+
+// after a store: if it hit this block, the rest of it is stale. hand the
+// 'left' instructions after it back to the budget and leave at 'next'
+void Jit::EmitExitIfInvalidated(uint8_t *block, uint16_t start, uint16_t next, unsigned int left){
+  Emit8(0x48); Emit8(0xB8); Emit64((uint64_t)block);     // mov rax, block
+  Emit8(0x49); Emit8(0x39); Emit8(0x85); Emit32(start * 8); // cmp [r13 + start*8], rax
+  Emit8(0x74);                                           // je alive
+  unsigned int alive_fixup = code_used;
+  Emit8(0);
+  Emit8(0x49); Emit8(0x81); Emit8(0xC4); Emit32(left);   // add r12, left
+  EmitStoreImmPc(next);
+  Emit8(0xE9); EmitRel32(exit_stub);                     // jmp exit_stub
+  code[alive_fixup] = code_used - (alive_fixup + 1);
+}
+
+uint8_t *Jit::Compile(uint16_t start){
+
+  // count instructions first, the budget check needs the block length
+  uint16_t addr = start;
+  unsigned int count = 0;
+  bool ends = false;
+
+  while(!ends && count < MAX_BLOCK_INSTRS && addr + 1 < 4096) {
+    uint16_t opcode = chip8->memory[addr] << 8 | chip8->memory[addr + 1];
+    uint8_t op = Chip8::decode_table[opcode];
+    if(op == Chip8::UNKNOWN_OPCODE) break;
+
+    auto handler = chip8->opcode_table[op].handler;
+    // timers read the virtual clock, which is only exact in the interpreter
+    if(handler == &Chip8::OpcodeFX07 || handler == &Chip8::OpcodeFX15 ||
+       handler == &Chip8::OpcodeFX18) break;
+
+    switch(opcode & 0xF000) {
+      case 0x1000: case 0x2000: case 0x3000: case 0x4000: case 0x5000:
+      case 0x9000: case 0xB000: case 0xE000:
+        ends = true;
+        break;
+    }
+    // stores go on, the block checks whether it's still there afterwards
+    if(handler == &Chip8::Opcode00EE || handler == &Chip8::OpcodeFX0A ||
+       handler == &Chip8::Opcode00FD || handler == &Chip8::Opcode00FE ||
+       handler == &Chip8::Opcode00FF)
+      ends = true;
+
+    addr += 2;
+    count++;
+  }
+
+  if(count == 0) return nullptr;
+
+  uint8_t *block = code + code_used;
+  uint16_t end = addr;
+
+  // budget check: cmp r12, count; jb bail; sub r12, count
+  Emit8(0x49); Emit8(0x81); Emit8(0xFC); Emit32(count);
+  Emit8(0x0F); Emit8(0x82);
+  unsigned int bail_fixup = code_used;
+  Emit32(0);
+  Emit8(0x49); Emit8(0x81); Emit8(0xEC); Emit32(count);
+
+  bool exited = false;
+  for(addr = start; addr < end; addr += 2) {
+
+    uint16_t opcode = chip8->memory[addr] << 8 | chip8->memory[addr + 1];
+    Chip8::Args args = Chip8::DecodeArgs(opcode);
+    auto handler = chip8->opcode_table[Chip8::decode_table[opcode]].handler;
+    uint16_t next = addr + 2;
+
+    if(handler == &Chip8::Opcode6XNN) {
+      Emit8(0xC6); EmitMem(0, Vx(args.X)); Emit8(args.NN);  // mov byte [Vx], NN
+    }
+    else if(handler == &Chip8::Opcode7XNN) {
+      Emit8(0x80); EmitMem(0, Vx(args.X)); Emit8(args.NN);  // add byte [Vx], NN
+    }
+    else if(handler == &Chip8::Opcode8XY0) {
+      Emit8(0x8A); EmitMem(0, Vx(args.Y));                  // mov al, [Vy]
+      Emit8(0x88); EmitMem(0, Vx(args.X));                  // mov [Vx], al
+    }
+    else if(handler == &Chip8::Opcode8XY1 || handler == &Chip8::Opcode8XY2 ||
+            handler == &Chip8::Opcode8XY3) {
+      uint8_t alu = (handler == &Chip8::Opcode8XY1) ? 0x08 : (handler == &Chip8::Opcode8XY2) ? 0x20 : 0x30;
+      Emit8(0x8A); EmitMem(0, Vx(args.Y));                  // mov al, [Vy]
+      Emit8(alu); EmitMem(0, Vx(args.X));                   // or/and/xor [Vx], al
+    }
+    else if(handler == &Chip8::Opcode8XY4) {
+      Emit8(0x0F); Emit8(0xB6); EmitMem(0, Vx(args.X));     // movzx eax, byte [Vx]
+      Emit8(0x0F); Emit8(0xB6); EmitMem(1, Vx(args.Y));     // movzx ecx, byte [Vy]
+      Emit8(0x01); Emit8(0xC8);                             // add eax, ecx
+      Emit8(0x88); EmitMem(0, Vx(args.X));                  // mov [Vx], al
+      Emit8(0xC1); Emit8(0xE8); Emit8(8);                   // shr eax, 8
+      Emit8(0x88); EmitMem(0, Vx(0xF));                     // mov [VF], al
+    }
+    else if(handler == &Chip8::Opcode8XY5 || handler == &Chip8::Opcode8XY7) {
+      bool rev = (handler == &Chip8::Opcode8XY7);
+      Emit8(0x0F); Emit8(0xB6); EmitMem(0, Vx(rev ? args.Y : args.X)); // movzx eax, minuend
+      Emit8(0x0F); Emit8(0xB6); EmitMem(1, Vx(rev ? args.X : args.Y)); // movzx ecx, subtrahend
+      Emit8(0x29); Emit8(0xC8);                             // sub eax, ecx
+      Emit8(0x0F); Emit8(0x99); Emit8(0xC2);                // setns dl
+      Emit8(0x88); EmitMem(0, Vx(args.X));                  // mov [Vx], al
+      Emit8(0x88); EmitMem(2, Vx(0xF));                     // mov [VF], dl
+    }
+    else if(handler == &Chip8::Opcode8XY6<false> || handler == &Chip8::Opcode8XY6<true> ||
+            handler == &Chip8::Opcode8XYE<false> || handler == &Chip8::Opcode8XYE<true>) {
+      bool left = (handler == &Chip8::Opcode8XYE<false> || handler == &Chip8::Opcode8XYE<true>);
+      Emit8(0x8A); EmitMem(0, Vx(quirks.shift ? args.X : args.Y)); // mov al, source
+      Emit8(0x88); Emit8(0xC1);                             // mov cl, al
+      if(left) {
+        Emit8(0xC0); Emit8(0xE9); Emit8(7);                 // shr cl, 7
+        Emit8(0xD0); Emit8(0xE0);                           // shl al, 1
+      } else {
+        Emit8(0x80); Emit8(0xE1); Emit8(1);                 // and cl, 1
+        Emit8(0xD0); Emit8(0xE8);                           // shr al, 1
+      }
+      Emit8(0x88); EmitMem(0, Vx(args.X));                  // mov [Vx], al
+      Emit8(0x88); EmitMem(1, Vx(0xF));                     // mov [VF], cl
+    }
+    else if(handler == &Chip8::OpcodeANNN) {
+      Emit8(0x66); Emit8(0xC7); EmitMem(0, off_I); Emit16(args.NNN); // mov word [I], NNN
+    }
+    else if(handler == &Chip8::OpcodeFX1E) {
+      Emit8(0x0F); Emit8(0xB7); EmitMem(0, off_I);          // movzx eax, word [I]
+      Emit8(0x0F); Emit8(0xB6); EmitMem(1, Vx(args.X));     // movzx ecx, byte [Vx]
+      Emit8(0x01); Emit8(0xC8);                             // add eax, ecx
+      Emit8(0x3D); Emit32(4095);                            // cmp eax, 4095
+      Emit8(0x76); Emit8(7);                                // jbe +7
+      Emit8(0xC6); EmitMem(0, Vx(0xF)); Emit8(1);           // mov byte [VF], 1
+      Emit8(0x66); Emit8(0x89); EmitMem(0, off_I);          // mov [I], ax
+    }
+    else if(handler == &Chip8::OpcodeFX29 || handler == &Chip8::OpcodeFX30) {
+      Emit8(0x0F); Emit8(0xB6); EmitMem(0, Vx(args.X));     // movzx eax, byte [Vx]
+      Emit8(0x8D); Emit8(0x04); Emit8(0x80);                // lea eax, [rax + rax*4]
+      if(handler == &Chip8::OpcodeFX30) {
+        Emit8(0x01); Emit8(0xC0);                           // add eax, eax
+        Emit8(0x05); Emit32(80);                            // add eax, 80
+      }
+      Emit8(0x66); Emit8(0x89); EmitMem(0, off_I);          // mov [I], ax
+    }
+    else if(handler == &Chip8::OpcodeFX65) {
+      Emit8(0x0F); Emit8(0xB7); EmitMem(0, off_I);          // movzx eax, word [I]
+      for(int i = 0; i <= args.X; i++) {
+        Emit8(0x8A); Emit8(0x8C); Emit8(0x03); Emit32(off_memory + i); // mov cl, [rbx + rax + memory + i]
+        Emit8(0x88); EmitMem(1, Vx(i));                     // mov [Vi], cl
+      }
+    }
+    else if(handler == &Chip8::OpcodeFX33) {
+      Emit8(0x0F); Emit8(0xB6); EmitMem(1, Vx(args.X));     // movzx ecx, byte [Vx]
+      // x / 10 is x * 205 >> 11 for every byte
+      Emit8(0x69); Emit8(0xD1); Emit32(205);                // imul edx, ecx, 205
+      Emit8(0xC1); Emit8(0xEA); Emit8(11);                  // shr edx, 11
+      Emit8(0x8D); Emit8(0x34); Emit8(0x92);                // lea esi, [rdx + rdx*4]
+      Emit8(0x01); Emit8(0xF6);                             // add esi, esi
+      Emit8(0x29); Emit8(0xF1);                             // sub ecx, esi (ones)
+      Emit8(0x69); Emit8(0xF2); Emit32(205);                // imul esi, edx, 205
+      Emit8(0xC1); Emit8(0xEE); Emit8(11);                  // shr esi, 11 (hundreds)
+      Emit8(0x8D); Emit8(0x3C); Emit8(0xB6);                // lea edi, [rsi + rsi*4]
+      Emit8(0x01); Emit8(0xFF);                             // add edi, edi
+      Emit8(0x29); Emit8(0xFA);                             // sub edx, edi (tens)
+      Emit8(0x0F); Emit8(0xB7); EmitMem(0, off_I);          // movzx eax, word [I]
+      Emit8(0x40); Emit8(0x88); Emit8(0xB4); Emit8(0x03); Emit32(off_memory); // mov [rbx + rax + memory], sil
+      Emit8(0x88); Emit8(0x94); Emit8(0x03); Emit32(off_memory + 1);          // mov [rbx + rax + memory + 1], dl
+      Emit8(0x88); Emit8(0x8C); Emit8(0x03); Emit32(off_memory + 2);          // mov [rbx + rax + memory + 2], cl
+      EmitCallInvalidate(3);
+      EmitExitIfInvalidated(block, start, next, (end - next) / 2);
+    }
+    else if(handler == &Chip8::OpcodeFX55) {
+      EmitStoreImmPc(next);
+      EmitCallHandler(opcode);
+      EmitExitIfInvalidated(block, start, next, (end - next) / 2);
+    }
+    else if(handler == &Chip8::Opcode2NNN) {
+      Emit8(0x8B); EmitMem(0, off_depth);                   // mov eax, [call_depth]
+      Emit8(0x0F); Emit8(0xB6); Emit8(0xC8);                // movzx ecx, al
+      Emit8(0x66); Emit8(0xC7); Emit8(0x84); Emit8(0x4B); Emit32(off_stack); Emit16(next); // mov word [rbx + rcx*2 + call_stack], next
+      Emit8(0x83); EmitMem(0, off_depth); Emit8(1);         // add dword [call_depth], 1
+      EmitStaticExit(args.NNN);
+      exited = true;
+    }
+    else if(handler == &Chip8::Opcode00EE) {
+      Emit8(0xB8); Emit32(next);                            // mov eax, next
+      Emit8(0x8B); EmitMem(1, off_depth);                   // mov ecx, [call_depth]
+      Emit8(0x85); Emit8(0xC9);                             // test ecx, ecx
+      Emit8(0x74);                                          // jz empty
+      unsigned int empty_fixup = code_used;
+      Emit8(0);
+      Emit8(0xFF); Emit8(0xC9);                             // dec ecx
+      Emit8(0x89); EmitMem(1, off_depth);                   // mov [call_depth], ecx
+      Emit8(0x0F); Emit8(0xB6); Emit8(0xC9);                // movzx ecx, cl
+      Emit8(0x0F); Emit8(0xB7); Emit8(0x84); Emit8(0x4B); Emit32(off_stack); // movzx eax, word [rbx + rcx*2 + call_stack]
+      code[empty_fixup] = code_used - (empty_fixup + 1);
+      EmitDynamicExit();
+      exited = true;
+    }
+    else if(handler == &Chip8::Opcode1NNN) {
+      EmitStaticExit(args.NNN);
+      exited = true;
+    }
+    else if(handler == &Chip8::OpcodeBNNN<false> || handler == &Chip8::OpcodeBNNN<true>) {
+      Emit8(0x0F); Emit8(0xB6); EmitMem(0, Vx(quirks.jump ? args.X : 0)); // movzx eax, byte [Vx]
+      Emit8(0x05); Emit32(args.NNN);                        // add eax, NNN
+      Emit8(0x25); Emit32(0xFFF);                           // and eax, 0xfff
+      EmitDynamicExit();
+      exited = true;
+    }
+    else if(handler == &Chip8::Opcode3XNN || handler == &Chip8::Opcode4XNN ||
+            handler == &Chip8::Opcode5XY0 || handler == &Chip8::Opcode9XY0) {
+      if(handler == &Chip8::Opcode3XNN || handler == &Chip8::Opcode4XNN) {
+        Emit8(0x80); EmitMem(7, Vx(args.X)); Emit8(args.NN); // cmp byte [Vx], NN
+      } else {
+        Emit8(0x8A); EmitMem(0, Vx(args.X));                // mov al, [Vx]
+        Emit8(0x3A); EmitMem(0, Vx(args.Y));                // cmp al, [Vy]
+      }
+      bool skip_eq = (handler == &Chip8::Opcode3XNN || handler == &Chip8::Opcode5XY0);
+      Emit8(0xB8); Emit32(next);                            // mov eax, next
+      Emit8(0xB9); Emit32(next + 2);                        // mov ecx, next + 2
+      Emit8(0x0F); Emit8(skip_eq ? 0x44 : 0x45); Emit8(0xC1); // cmove/cmovne eax, ecx
+      EmitDynamicExit();
+      exited = true;
+    }
+    else if(handler == &Chip8::OpcodeFX0A) {
+      Emit8(0x83); EmitMem(7, off_last_key); Emit8(0xFF);   // cmp dword [last_key], -1
+      Emit8(0x75);                                          // jne pressed
+      unsigned int pressed_fixup = code_used;
+      Emit8(0);
+      Emit8(0xC6); EmitMem(0, off_status); Emit8((uint8_t)Chip8::RunStatus::KeyWait); // mov byte [status], KeyWait
+      EmitStoreImmPc(addr);
+      Emit8(0xE9); EmitRel32(exit_stub);                    // jmp exit_stub
+      code[pressed_fixup] = code_used - (pressed_fixup + 1);
+      Emit8(0x8A); EmitMem(0, off_last_key);                // mov al, [last_key]
+      Emit8(0x88); EmitMem(0, Vx(args.X));                  // mov [Vx], al
+      EmitStaticExit(next);
+      exited = true;
+    }
+    else {
+      // everything else goes through the interpreter handler,
+      // which may read or change pc
+      EmitStoreImmPc(next);
+      EmitCallHandler(opcode);
+      if(addr + 2 == end) {
+        // handler asked to stop (e.g. 00FD)
+        Emit8(0x80); EmitMem(7, off_status); Emit8(0);      // cmp byte [status], 0
+        Emit8(0x0F); Emit8(0x85); EmitRel32(exit_stub);     // jne exit_stub
+        Emit8(0x0F); Emit8(0xB7); EmitMem(0, off_pc);       // movzx eax, word [pc]
+        EmitDynamicExit();
+        exited = true;
+      }
+    }
+  }
+
+  if(!exited) EmitStaticExit(end);
+
+  // not enough budget left, let the interpreter finish
+  uint8_t *bail = code + code_used;
+  EmitStoreImmPc(start);
+  Emit8(0xE9); EmitRel32(exit_stub);
+  int32_t rel = (int32_t)(bail - (code + bail_fixup + 4));
+  memcpy(code + bail_fixup, &rel, 4);
+
+  blocks.push_back({start, end});
+  for(int i = start; i < end; i++) covered[i] = true;
+
+  return block;
+}
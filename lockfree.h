@@ -0,0 +1,68 @@
+#pragma once
+// Lock-free handoff between the emulator thread and the GL thread (main.cpp).
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Latest-value channel for one producer and one consumer. The producer fills
+// Back() and publishes it, the consumer takes whatever was published last,
+// frames it was too slow for are dropped. Neither side ever waits.
+template<class T>
+class TripleBuffer {
+
+  public:
+    // producer
+    T &Back() { return buffers[back]; }
+    void Publish() {
+      uint8_t old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+      back = old & INDEX;
+    }
+
+    // consumer, true when Front() was replaced by a newer frame
+    bool Consume() {
+      if(!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+      uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+      front = old & INDEX;
+      return true;
+    }
+    const T &Front() const { return buffers[front]; }
+
+  private:
+    static const uint8_t INDEX = 3, FRESH = 4;
+    T buffers[3] = {};
+    // each side owns one buffer, the one in the middle changes hands
+    uint8_t back = 0, front = 1;
+    std::atomic<uint8_t> middle{2};
+};
+
+// Bounded queue for one producer and one consumer, N has to be a power of 2.
+template<class T, size_t N>
+class SpscQueue {
+
+  static_assert((N & (N - 1)) == 0, "N has to be a power of 2");
+
+  public:
+    // false when full
+    bool Push(const T &item) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if(h - tail.load(std::memory_order_acquire) == N) return false;
+      items[h & (N - 1)] = item;
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    // false when empty
+    bool Pop(T &item) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if(t == head.load(std::memory_order_acquire)) return false;
+      item = items[t & (N - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    T items[N];
+    // on separate cache lines so the two threads don't fight over them
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
@@ -2,13 +2,31 @@
 #include <cstdio>
 #include <stdint.h>
 #include <thread>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <cstring>
+#include <cmath>
 //opengl headers
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "shaders.h"
 //my headers
-#include "chip8.cpp"
+#include "chip8.h"
+#include "beep.cpp"
+#include "pcspkr.cpp"
 #include "renderer.h"
+#include "lockfree.h"
+#include "rewind.h"
+#include "movie.h"
+#include "profile.h"
+#include "callgraph.h"
 
 void process_input(GLFWwindow *window, Chip8 *chip8);
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
@@ -20,15 +38,177 @@ const int SCR_HEIGHT = 32 * PIXEL_SIZE;
 
 bool hires = false;
 
-bool *key_pressed;
-int *last_key_pressed;
+// what the GL thread needs to draw one emulated frame
+struct Frame {
+  uint64_t display[64 * Chip8::DISPLAY_ROW_WORDS];
+  bool hires;
+  uint16_t pc, I;
+  uint8_t V[16];
+};
+
+// executions per guest address for the --heatmap overlay, log scaled to 0..1
+struct Heatmap {
+  float heat[4096];
+};
+
+struct KeyEvent {
+  int key;
+  bool pressed;
+};
+
+// emulator thread -> GL thread
+TripleBuffer<Frame> frames;
+// rows changed in frames the GL thread hasn't uploaded yet. a frame is
+// published before its rows are added here, so whenever the GL thread sees
+// a row it also gets a frame that has it
+std::atomic<uint64_t> dirty_rows{0};
+// only published while the overlay is shown
+TripleBuffer<Heatmap> heatmaps;
+// GL thread -> emulator thread
+SpscQueue<KeyEvent, 64> key_events;
+std::atomic<bool> quit{false};
+// held Tab, runs as fast as possible
+std::atomic<bool> turbo{false};
+// held Backspace, goes back one frame every display frame
+std::atomic<bool> rewinding{false};
+// F2, writes opcode stats (--stats) from the emulator thread
+std::atomic<bool> dump_stats{false};
+// F3, the --heatmap overlay
+std::atomic<bool> show_heatmap{false};
+
+// runs the emulator at 60 frames a second times speed (0 is as fast as
+// possible), no matter how long swaps take. timers run on emulated frames,
+// so they speed up with everything else.
+// 'recording' gets every change of the keys, 'playback' (until it's over)
+// feeds the keys instead of the keyboard, either can be nullptr
+void EmulatorThread(Chip8 *chip8, double speed, Movie *recording, Movie *playback, std::string stats_file){
+
+  auto interval = std::chrono::nanoseconds(1000000000 / 60);
+  auto next = std::chrono::steady_clock::now();
+  // frames owed for fractional speeds
+  double credit = 0;
+  // the last minute, a few MB at most
+  Rewind history;
+  // what the host keyboard holds, a rewound state has the keys of its own frame
+  bool held[16] = {};
+  unsigned int heat_frames = 0;
+
+  auto playing = [&]() {
+    if(playback && playback->Finished(*chip8)) {
+      puts("movie finished, the keyboard takes over");
+      playback = nullptr;
+      for(int k = 0; k < 16; k++) chip8->key_pressed[k] = held[k];
+      chip8->last_key_pressed = -1;
+    }
+    return playback != nullptr;
+  };
+  auto run_frame = [&]() {
+    return playing() ? playback->RunUntilFrame(*chip8) : chip8->RunUntilFrame();
+  };
+
+  while(!quit.load(std::memory_order_relaxed)){
+
+    if(dump_stats.exchange(false) && !stats_file.empty()) {
+      if(chip8->WriteStats(stats_file.c_str())) printf("opcode stats written to %s\n", stats_file.c_str());
+      else std::cerr << "Failed to write " << stats_file << '\n';
+    }
+
+    KeyEvent event;
+    while(key_events.Pop(event)){
+      held[event.key] = event.pressed;
+      if(playing()) continue;
+      chip8->last_key_pressed = -1;
+      chip8->SetKey(event.key, event.pressed);
+      if(recording) recording->Input(*chip8);
+    }
+
+    // breakpoints and 00FD just end the frame early,
+    // the next frame runs into them again
+    bool rewind = rewinding.load(std::memory_order_relaxed);
+    bool unthrottled = !rewind && (speed == 0 || turbo.load(std::memory_order_relaxed));
+    if(rewind) {
+      if(history.Step(*chip8)) {
+        if(playback) playback->Seek(*chip8);
+        else {
+          for(int k = 0; k < 16; k++) chip8->key_pressed[k] = held[k];
+          chip8->last_key_pressed = -1;
+          // what happened after this frame never did
+          if(recording) {
+            recording->Truncate(*chip8);
+            recording->Input(*chip8);
+          }
+        }
+      }
+    }
+    else if(unthrottled) {
+      // only the last of these frames is shown, so run for a quarter of a
+      // display frame before publishing
+      auto until = std::chrono::steady_clock::now() + interval / 4;
+      while(run_frame() == Chip8::RunStatus::FrameEnd &&
+            std::chrono::steady_clock::now() < until)
+        history.Capture(*chip8);
+      history.Capture(*chip8);
+    }
+    else {
+      for(credit += speed; credit >= 1; credit--) {
+        bool frame_end = run_frame() == Chip8::RunStatus::FrameEnd;
+        history.Capture(*chip8);
+        if(!frame_end) {
+          credit = 0;
+          break;
+        }
+      }
+    }
+
+    Frame &frame = frames.Back();
+    memcpy(frame.display, chip8->DisplayRow(0), sizeof(frame.display));
+    frame.hires = chip8->hires;
+    frame.pc = chip8->pc;
+    frame.I = chip8->I;
+    memcpy(frame.V, chip8->V, sizeof(frame.V));
+    frames.Publish();
+    dirty_rows.fetch_or(chip8->TakeDirtyRows(), std::memory_order_release);
+    chip8->redraw_screen = false;
+
+    // the overlay changes slowly, 4 times a second is plenty
+    if(chip8->stats && show_heatmap.load(std::memory_order_relaxed) && ++heat_frames % 15 == 0) {
+      const uint64_t *count = chip8->stats->address_count;
+      float scale = 1.0f / log1pf((float)std::max<uint64_t>(1, *std::max_element(count, count + 4096)));
+      Heatmap &heatmap = heatmaps.Back();
+      for(int addr = 0; addr < 4096; addr++) heatmap.heat[addr] = log1pf((float)count[addr]) * scale;
+      heatmaps.Publish();
+    }
+
+    // sleep to a fixed schedule, so a late frame doesn't push all the next ones
+    auto now = std::chrono::steady_clock::now();
+    if(unthrottled) {
+      next = now;
+      continue;
+    }
+    next += interval;
+    if(next < now - interval * 4) next = now;
+    std::this_thread::sleep_until(next);
+  }
+}
 
 struct Settings { 
   unsigned int ticks_in_sec = 60 * 7;
+  // multiple of real time, 0 is unthrottled
+  double speed = 1;
   bool redraw_every_opcode = false;
   bool debugging_mode = false;
   bool logs = false;
   bool pcspkr = false;
+  bool gl_stats = false;
+  bool pbo = false;
+  std::string aot_file;
+  std::string record_file;
+  std::string play_file;
+  std::string stats_file;
+  unsigned int stats_sample = 0;
+  std::string profile_file;
+  std::string callgraph_file;
+  bool heatmap = false;
 };
 
 struct Settings settings;
@@ -36,8 +216,6 @@ struct Settings settings;
 int main(int argc, char* argv[]){
   
   Chip8 chip8;
-  key_pressed = chip8.key_pressed;
-  last_key_pressed = &chip8.last_key_pressed;
 
   if(argc < 2) {
     throw std::invalid_argument("Usage: chip8 (optional args) <ROM file>");
@@ -52,12 +230,31 @@ int main(int argc, char* argv[]){
       puts("Usage: ./chip8 [options...] <file>\n\
               -t,  --ticks <num>             Ticks per second, must be 1-10000\n\
               -e,  --extend <version>        Extend chip8. Available: schip\n\
+              -q,  --quirks <list>           Comma separated quirks. Available: chip8, schip, jump, shift, clip\n\
               -b,  --breakpoint <addr in hex>Sets breakpoint on a particular address\n\
               -d,  --disassembly             Print executed instructions to stderr\n\
               -df, --disassembly-file <file> Dissasembly file and print\n\
               -r,  --refresh                 Set glfwSwapInterval(0) (Increases CPU usage)\n\
+              --speed <factor|max>           Run at a multiple of real time, or as fast as possible\n\
+                                             (hold Tab for max)\n\
+              --core <name>                  Interpreter core. Available: table, threaded, jit, aot\n\
+              --aot <file>                   Load ROM compiled by chip8-aot (implies --core aot)\n\
               --beep, --pcspkr               If there's a buzzer on your motherboard then use it for sound\n\
+              --record <file>                Record input to a movie, saved on exit\n\
+              --play <file>                  Play a movie, then hand over to the keyboard\n\
+              --stats <file>                 Write executions per opcode as JSON on exit and on F2\n\
+                                             (runs the table core)\n\
+              --stats-sample <n>             Also time every n-th instruction for --stats\n\
+              --profile <file>               Write hot addresses and loops on exit (runs the table core)\n\
+              --callgraph <file>             Write instructions per guest call chain as collapsed stacks\n\
+                                             on exit, for flame graph tools (runs the table core)\n\
+              --heatmap                      Overlay executions per address, F3 toggles it\n\
+                                             (runs the table core)\n\
+              --gl-stats                     Print texture upload timings every second\n\
+              --pbo                          Upload the texture through a ring of pixel buffer objects\n\
               -h,  --help                    Print this\n\
+\n\
+            Hold Backspace to rewind, up to a minute back.\n\
          ");
     return 0;
   }
@@ -111,12 +308,59 @@ int main(int argc, char* argv[]){
     
     // TODO explicit extension
     else if((arg == "-e") || (arg == "--extend")) {}
-    // TODO
-    else if((arg == "-q") || (arg == "--quirks")) {}
+    else if((arg == "-q") || (arg == "--quirks")) {
+      struct Chip8::Quirks quirks;
+      if(!Chip8::ParseQuirks(args.at(i + 1), quirks))
+        throw std::invalid_argument("Invalid quirks, available: chip8, schip, jump, shift, clip");
+      chip8.SetQuirks(quirks);
+      i++;
+    }
    
     else if((arg == "--beep") || (arg == "--pcspkr")){
-      chip8.pcspkr = true;
+      settings.pcspkr = true;
+    }
+
+    else if(arg == "--speed") {
+      std::string speed = args.at(i + 1);
+      if(speed == "max") settings.speed = 0;
+      else {
+        settings.speed = std::stod(speed);
+        if(!(settings.speed > 0 && settings.speed <= 1000))
+          throw std::invalid_argument("Invalid speed, must be max or a factor between 0 and 1000");
+      }
+      i++;
+    }
+
+    else if(arg == "--record") {
+      settings.record_file = args.at(i + 1);
+      i++;
+    }
+    else if(arg == "--play") {
+      settings.play_file = args.at(i + 1);
+      i++;
+    }
+
+    else if(arg == "--stats") {
+      settings.stats_file = args.at(i + 1);
+      i++;
+    }
+    else if(arg == "--stats-sample") {
+      settings.stats_sample = std::stoul(args.at(i + 1));
+      i++;
+    }
+
+    else if(arg == "--profile") {
+      settings.profile_file = args.at(i + 1);
+      i++;
+    }
+    else if(arg == "--callgraph") {
+      settings.callgraph_file = args.at(i + 1);
+      i++;
     }
+    else if(arg == "--heatmap") settings.heatmap = true;
+
+    else if(arg == "--gl-stats") settings.gl_stats = true;
+    else if(arg == "--pbo") settings.pbo = true;
 
     //TODO logging to a file
     else if((arg == "-l") || (arg == "--log")) settings.logs = true;
@@ -129,6 +373,18 @@ int main(int argc, char* argv[]){
        settings.redraw_every_opcode = true;
     }
 
+    else if(arg == "--core") {
+      if(!Chip8::ParseCore(args.at(i + 1), chip8.core))
+        throw std::invalid_argument("Invalid core, available: table, threaded, jit, aot");
+      i++;
+    }
+
+    else if(arg == "--aot") {
+      settings.aot_file = args.at(i + 1);
+      chip8.core = Chip8::Core::Aot;
+      i++;
+    }
+
     else {
         std::cerr << "Invalid argument: " << arg << '\n';
         return -1;
@@ -140,8 +396,21 @@ int main(int argc, char* argv[]){
     throw std::invalid_argument("Invalid ROM");
     return -1;
   }
+
+  std::unique_ptr<AudioSink> audio;
+  if(settings.pcspkr) {
+    audio.reset(new PcSpeaker());
+  }
+  else {
+    Beep *beep = new Beep();
+    beep->Init();
+    audio.reset(beep);
+  }
+  chip8.audio = audio.get();
   
-  Renderer renderer(&chip8.screen);
+  Renderer renderer(&chip8);
+  renderer.gl_stats = settings.gl_stats;
+  renderer.use_pbo = settings.pbo;
   //https://www.glfw.org/docs/3.3/intro_guide.html
   glfwInit();
 
@@ -171,6 +440,7 @@ int main(int argc, char* argv[]){
 
   Shader my_shader("vshader.vs", "fshader.fs");
   Shader text_shader("vtextshader.vs", "ftextshader.fs");
+  Shader heatmap_shader("vshader.vs", "fheatmap.fs");
   
   renderer.Init();
   
@@ -187,35 +457,71 @@ int main(int argc, char* argv[]){
   }
 
 
-  uint32_t interval = 1000000000 / settings.ticks_in_sec;   
+  chip8.cycles_per_frame = std::max(1u, settings.ticks_in_sec / 60);
+
+  // movies set quirks, speed and seed, so after everything else touched them
+  std::unique_ptr<Movie> playback, recording;
+  if(!settings.play_file.empty()) {
+    playback.reset(new Movie());
+    if(!playback->Load(settings.play_file.c_str()))
+      throw std::invalid_argument("Invalid movie");
+    if(!playback->Start(chip8))
+      throw std::invalid_argument("The movie was recorded with another ROM");
+  }
+  // after the movie, it may have changed quirks
+  if(!settings.aot_file.empty() && !chip8.LoadAot(settings.aot_file.c_str())){
+    throw std::invalid_argument("Invalid compiled ROM, it has to be made by chip8-aot from the same ROM");
+  }
+  if(!settings.record_file.empty()) {
+    if(playback) throw std::invalid_argument("Can't record and play a movie at the same time");
+    recording.reset(new Movie());
+    recording->Record(chip8, time(NULL));
+  }
+
   float scale = (float)PIXEL_SIZE / (float)renderer.font_size;
   
+  // nothing below touches chip8 until the thread is joined
+  OpcodeStats stats;
+  stats.sample_interval = settings.stats_sample;
+  CallGraph calls;
+  if(!settings.callgraph_file.empty()) stats.calls = &calls;
+  if(!settings.stats_file.empty() || !settings.profile_file.empty() || stats.calls || settings.heatmap) chip8.stats = &stats;
+  show_heatmap = settings.heatmap;
+
+  std::thread emulator_thread(EmulatorThread, &chip8, settings.speed, recording.get(), playback.get(), settings.stats_file);
+
   bool extended_mode = 0;
+  bool heatmap_shown = false;
   while(!glfwWindowShouldClose(window)){
-          
-    auto start = std::chrono::steady_clock::now();
-
-    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
 
-    chip8.MainLoop();
- 
-    if(chip8.redraw_screen) {
-      if(extended_mode != chip8.hires){
-        extended_mode = chip8.hires;
+    // rows first, then the frame, see dirty_rows
+    uint64_t dirty = dirty_rows.exchange(0, std::memory_order_acquire);
+    bool fresh = frames.Consume();
+    const Frame &frame = frames.Front();
+    bool fresh_heat = heatmaps.Consume();
+    bool overlay = show_heatmap.load(std::memory_order_relaxed);
+    bool overlay_changed = overlay != heatmap_shown;
+    heatmap_shown = overlay;
+
+    if(dirty || (fresh && settings.debugging_mode) || overlay_changed || (fresh_heat && overlay)) {
+      glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+      glClear(GL_COLOR_BUFFER_BIT);
+
+      if(extended_mode != frame.hires){
+        extended_mode = frame.hires;
         renderer.ExtendedModeChange(extended_mode);
       }
-      renderer.Render(my_shader, true); 
+      renderer.Render(my_shader, frame.display, dirty); 
+      if(overlay) renderer.RenderHeatmap(heatmap_shader, heatmaps.Front().heat);
       
       if(settings.debugging_mode){
-        renderer.Render(my_shader, false);
 
         std::string pc = "PC 0x";
         std::string i = "I 0x";
 
         std::stringstream sstream_pc, sstream_i;
-        sstream_pc << std::hex << chip8.pc;
-        sstream_i << std::hex << chip8.I;
+        sstream_pc << std::hex << frame.pc;
+        sstream_i << std::hex << frame.I;
         
         pc += sstream_pc.str();
         i += sstream_i.str();
@@ -227,7 +533,7 @@ int main(int argc, char* argv[]){
         for(int i = 0; i < 16; i++){
           std::string v =  "V" + std::to_string(i) + " 0x";
           std::stringstream v_hex;
-          v_hex << std::hex << (int) chip8.V[i];
+          v_hex << std::hex << (int) frame.V[i];
           v += v_hex.str();
 
           renderer.RenderText(text_shader, v, 0.0f, 1 + SCR_HEIGHT - PIXEL_SIZE * (i + 3), scale, glm::vec3(1.0, 0.0f, 0.0f));
@@ -235,21 +541,24 @@ int main(int argc, char* argv[]){
 
       }
       
-      chip8.redraw_screen = 0;
       glfwSwapBuffers(window);
+      glfwPollEvents();
     }
+    // nothing new to show, wait for input or the next frame
+    else glfwWaitEventsTimeout(0.002);
+  }
 
-    
-    glfwPollEvents();
+  quit = true;
+  emulator_thread.join();
 
-    auto end = std::chrono::steady_clock::now();
-    auto delta_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count();
-      //printf("delta_time: %ld\n", delta_time);
-      
-    if(delta_time < interval){
-      std::this_thread::sleep_for(std::chrono::nanoseconds(interval - delta_time));
-    }
-  }
+  if(!settings.stats_file.empty() && !chip8.WriteStats(settings.stats_file.c_str()))
+    std::cerr << "Failed to write " << settings.stats_file << '\n';
+  if(!settings.profile_file.empty() && !WriteProfile(settings.profile_file.c_str(), chip8, stats))
+    std::cerr << "Failed to write " << settings.profile_file << '\n';
+  if(stats.calls && !calls.WriteCollapsed(settings.callgraph_file.c_str(), CallGraph::Weight::Instructions, stats.sample_interval))
+    std::cerr << "Failed to write " << settings.callgraph_file << '\n';
+  if(recording && !recording->Save(settings.record_file.c_str(), chip8))
+    std::cerr << "Failed to save the movie to " << settings.record_file << '\n';
 
   glfwDestroyWindow(window);
   glfwTerminate();
@@ -273,11 +582,29 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     return;
   }
 
-  *last_key_pressed = -1;
-  
+  if(key == GLFW_KEY_TAB) {
+    turbo = (action != GLFW_RELEASE);
+    return;
+  }
+
+  if(key == GLFW_KEY_BACKSPACE) {
+    rewinding = (action != GLFW_RELEASE);
+    return;
+  }
+
   if(glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS)
     settings.debugging_mode = !settings.debugging_mode;
 
+  if(key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+    dump_stats = true;
+    return;
+  }
+
+  if(key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+    if(settings.heatmap) show_heatmap = !show_heatmap;
+    return;
+  }
+
   
   int k_inx = -1;
   switch(key){
@@ -337,14 +664,8 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 
   if(k_inx == -1) return;
 
-  if(action == GLFW_RELEASE) {
-    key_pressed[k_inx] = false;
-  }
-  
-  else {
-    key_pressed[k_inx] = true;
-    *last_key_pressed = k_inx;
-  }
+  // the emulator thread picks it up before its next frame
+  key_events.Push({k_inx, action != GLFW_RELEASE});
 
 }
 
@@ -0,0 +1,113 @@
+// Input movies, see movie.h.
+#include <cstdio>
+#include <memory>
+#include "movie.h"
+
+uint64_t Movie::RomHash(const Chip8 &chip8){
+  uint64_t hash = 14695981039346656037ull;
+  for(int i = 0x200; i < 4096; i++) {
+    hash ^= chip8.memory[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+void Movie::Record(Chip8 &chip8, uint32_t seed){
+
+  chip8.Seed(seed);
+  header = {};
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.rom_hash = RomHash(chip8);
+  header.seed = seed;
+  header.cycles_per_frame = chip8.cycles_per_frame;
+  header.quirks = chip8.quirks.jump | chip8.quirks.shift << 1 | chip8.quirks.clip_sprite << 2;
+  events.clear();
+  next = 0;
+}
+
+void Movie::Input(const Chip8 &chip8){
+
+  Event e = {};
+  e.instruction = chip8.instructions;
+  for(int k = 0; k < 16; k++) e.keys |= chip8.key_pressed[k] << k;
+  e.last_key = chip8.last_key_pressed;
+
+  // nothing would change on playback
+  if(!events.empty() && events.back().keys == e.keys && events.back().last_key == e.last_key) return;
+  events.push_back(e);
+}
+
+void Movie::Truncate(const Chip8 &chip8){
+  // input at the current instruction came after the state being restored
+  while(!events.empty() && events.back().instruction >= chip8.instructions) events.pop_back();
+}
+
+bool Movie::Save(const char *filename, const Chip8 &chip8){
+
+  header.event_count = events.size();
+  header.length = chip8.instructions;
+
+  std::unique_ptr<FILE, int(*)(FILE*)> f(fopen(filename, "wb"), fclose);
+  if(f == nullptr) return false;
+  if(fwrite(&header, sizeof(header), 1, f.get()) != 1) return false;
+  return fwrite(events.data(), sizeof(Event), events.size(), f.get()) == events.size();
+}
+
+bool Movie::Load(const char *filename){
+
+  std::unique_ptr<FILE, int(*)(FILE*)> f(fopen(filename, "rb"), fclose);
+  if(f == nullptr) return false;
+
+  Header in;
+  if(fread(&in, sizeof(in), 1, f.get()) != 1) return false;
+  if(in.magic != MAGIC || in.version != VERSION) return false;
+
+  std::vector<Event> in_events(in.event_count);
+  if(fread(in_events.data(), sizeof(Event), in.event_count, f.get()) != in.event_count) return false;
+
+  header = in;
+  events.swap(in_events);
+  next = 0;
+  return true;
+}
+
+bool Movie::Start(Chip8 &chip8){
+
+  if(RomHash(chip8) != header.rom_hash) return false;
+
+  struct Chip8::Quirks quirks;
+  quirks.jump = header.quirks & 1;
+  quirks.shift = header.quirks & 2;
+  quirks.clip_sprite = header.quirks & 4;
+  // SetQuirks drops cached and compiled code, keep it when nothing changes
+  if(quirks.jump != chip8.quirks.jump || quirks.shift != chip8.quirks.shift || quirks.clip_sprite != chip8.quirks.clip_sprite)
+    chip8.SetQuirks(quirks);
+  chip8.cycles_per_frame = header.cycles_per_frame;
+  chip8.Seed(header.seed);
+  next = 0;
+  return true;
+}
+
+Chip8::RunStatus Movie::RunUntilFrame(Chip8 &chip8){
+
+  while(true) {
+    for(; next < events.size() && events[next].instruction <= chip8.instructions; next++) {
+      for(int k = 0; k < 16; k++) chip8.key_pressed[k] = (events[next].keys >> k) & 1;
+      chip8.last_key_pressed = events[next].last_key;
+    }
+
+    // stop exactly where the next input has to go in
+    uint64_t cycles = UINT64_MAX;
+    if(next < events.size()) cycles = events[next].instruction - chip8.instructions;
+
+    Chip8::RunStatus status = chip8.RunUntilFrame(cycles);
+    if(status == Chip8::RunStatus::Running) continue;
+    return status;
+  }
+}
+
+void Movie::Seek(const Chip8 &chip8){
+  next = 0;
+  while(next < events.size() && events[next].instruction < chip8.instructions) next++;
+}
@@ -0,0 +1,71 @@
+#pragma once
+// Input movies: everything needed to play a session again bit for bit.
+// The core is deterministic given the ROM, quirks, instructions per frame and
+// CXNN seed, so a movie is those plus every change of the keys, stamped with
+// the instruction count it happened at. Wall clock time isn't recorded at all,
+// frames are instructions / cycles_per_frame anyway.
+//
+// The file is a Header and then header.event_count Events, host byte order
+// like save states.
+#include <stdint.h>
+#include <vector>
+
+#include "chip8.h"
+
+class Movie {
+
+  public:
+    static const uint32_t MAGIC = 0x4d384843; // "CH8M"
+    // 2: key waits skip the rest of their frame
+    static const uint32_t VERSION = 2;
+
+    struct Header {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t rom_hash;        // FNV-1a of memory from 0x200 right after LoadRom
+      uint32_t seed;
+      uint32_t cycles_per_frame;
+      uint8_t quirks;           // jump | shift << 1 | clip_sprite << 2
+      uint8_t pad[3];
+      uint32_t event_count;
+      uint64_t length;          // instructions executed when recording stopped
+    };
+
+    // key state the frontend set, applied before instruction 'instruction' + 1
+    struct Event {
+      uint64_t instruction;
+      uint16_t keys;            // bit k is key k
+      int8_t last_key;
+      uint8_t pad[5];
+    };
+
+    // recording, right after LoadRom. seeds chip8 and takes its quirks and
+    // instructions per frame, which must not change afterwards
+    void Record(Chip8 &chip8, uint32_t seed);
+    // after the frontend changed key_pressed or last_key_pressed
+    void Input(const Chip8 &chip8);
+    // forgets input from the current instruction on, after a rewind
+    void Truncate(const Chip8 &chip8);
+    // ends the movie at the current instruction
+    bool Save(const char *filename, const Chip8 &chip8);
+
+    // playback
+    bool Load(const char *filename);
+    // sets up chip8 right after LoadRom, false if it's another ROM
+    bool Start(Chip8 &chip8);
+    // RunUntilFrame with the recorded input
+    Chip8::RunStatus RunUntilFrame(Chip8 &chip8);
+    // picks up at the current instruction, after a rewind
+    void Seek(const Chip8 &chip8);
+    bool Finished(const Chip8 &chip8) const { return chip8.instructions >= header.length; }
+
+    const Header &Info() const { return header; }
+
+  private:
+    Header header = {};
+    std::vector<Event> events;
+    // next event to play
+    size_t next = 0;
+
+    static uint64_t RomHash(const Chip8 &chip8);
+};
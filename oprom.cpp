@@ -0,0 +1,133 @@
+// Opcode microbenchmark ROMs, see oprom.h.
+#include "oprom.h"
+
+static const int UNROLL = 32;
+// far enough from the code that writes there don't invalidate it
+static const uint16_t DATA = 0x800;
+static const uint16_t SUBROUTINE = 0x700;
+
+// just enough of an assembler to lay out a ROM from 0x200
+class RomBuilder {
+
+  public:
+    uint16_t Here() const { return 0x200 + data.size(); }
+    void Op(uint16_t op) {
+      data.push_back(op >> 8);
+      data.push_back(op & 0xFF);
+    }
+    void Byte(uint8_t b) { data.push_back(b); }
+    // pads up to 'addr' with zeros
+    void Org(uint16_t addr) { data.resize(addr - 0x200, 0); }
+    std::vector<uint8_t> data;
+};
+
+// setup, then a loop of UNROLL bodies, and whatever has to follow the loop
+template<class Setup, class Body, class After>
+static OpcodeRom Make(const char *name, const char *description, bool hires, Setup setup, Body body, After after){
+
+  RomBuilder rom;
+  if(hires) rom.Op(0x00FF);
+  setup(rom);
+  uint16_t loop = rom.Here();
+  for(int i = 0; i < UNROLL; i++) body(rom, i);
+  rom.Op(0x1000 | loop);
+  after(rom);
+  return { name, description, rom.data, hires };
+}
+
+// V0-VE get different values, so ALU ops don't just see zeros
+static void SetRegisters(RomBuilder &rom){
+  for(int x = 0; x < 15; x++) rom.Op(0x6000 | x << 8 | ((x * 37 + 11) & 0xFF));
+}
+
+// 16 bytes of sprite, a 8x16 or the top half of a 16x16 one
+static void SpriteData(RomBuilder &rom, int bytes){
+  rom.Org(DATA);
+  for(int i = 0; i < bytes; i++) rom.Byte((i * 73 + 0x5A) & 0xFF);
+}
+
+static void Nothing(RomBuilder &){}
+
+std::vector<OpcodeRom> OpcodeRoms(){
+
+  std::vector<OpcodeRom> roms;
+
+  roms.push_back(Make("add", "7XNN", false, SetRegisters,
+    [](RomBuilder &rom, int i) { rom.Op(0x7000 | (i % 15) << 8 | 3); }, Nothing));
+
+  roms.push_back(Make("alu", "8XY1 8XY2 8XY3 8XY4 8XY5 8XY6 8XY7 8XYE", false, SetRegisters,
+    [](RomBuilder &rom, int i) {
+      static const uint16_t ops[] = { 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+      int x = i % 14, y = (i * 5 + 1) % 14;
+      rom.Op(0x8000 | x << 8 | y << 4 | ops[i % 8]);
+    }, Nothing));
+
+  // half taken, half not: V0 = 0, V1 = 1
+  roms.push_back(Make("skip", "3XNN 4XNN 5XY0 9XY0", false,
+    [](RomBuilder &rom) { rom.Op(0x6000); rom.Op(0x6101); },
+    [](RomBuilder &rom, int i) {
+      static const uint16_t ops[] = { 0x3001, 0x4000, 0x5010, 0x9010, 0x3000, 0x4001, 0x5000, 0x9000 };
+      rom.Op(ops[i % 8]);
+      // skipped or not, it's the next pair either way
+      rom.Op(0x7201);
+    }, Nothing));
+
+  roms.push_back(Make("call", "2NNN 00EE", false, Nothing,
+    [](RomBuilder &rom, int) { rom.Op(0x2000 | SUBROUTINE); },
+    [](RomBuilder &rom) { rom.Org(SUBROUTINE); rom.Op(0x00EE); }));
+
+  roms.push_back(Make("jump", "1NNN", false, Nothing,
+    // every jump goes to the next instruction
+    [](RomBuilder &rom, int) { rom.Op(0x1000 | (rom.Here() + 2)); }, Nothing));
+
+  // V0-VD hold x positions and VE the y, so the loop is nothing but draws.
+  // the same 8x8 sprite at x = 8n keeps to one byte of a row
+  auto draws = [](int x0, int step, int width) {
+    return [=](RomBuilder &rom) {
+      for(int x = 0; x < 14; x++) rom.Op(0x6000 | x << 8 | ((x0 + x * step) % width));
+      rom.Op(0x6E00 | 3);
+      rom.Op(0xA000 | DATA);
+    };
+  };
+  roms.push_back(Make("draw aligned", "DXY8 at x = 8n", false, draws(0, 8, 64),
+    [](RomBuilder &rom, int i) { rom.Op(0xD0E8 | (i % 14) << 8); },
+    [](RomBuilder &rom) { SpriteData(rom, 16); }));
+
+  roms.push_back(Make("draw unaligned", "DXY8 at x = 8n + 3", false, draws(3, 8, 64),
+    [](RomBuilder &rom, int i) { rom.Op(0xD0E8 | (i % 14) << 8); },
+    [](RomBuilder &rom) { SpriteData(rom, 16); }));
+
+  // a few of them are cut off at the right edge
+  roms.push_back(Make("draw hires 16x16", "DXY0 in 128x64", true, draws(5, 9, 128),
+    [](RomBuilder &rom, int i) { rom.Op(0xD0E0 | (i % 14) << 8); },
+    [](RomBuilder &rom) { SpriteData(rom, 32); }));
+
+  // on a screen full of sprites, so they move something
+  auto fill_screen = [](RomBuilder &rom) {
+    rom.Op(0xA000 | DATA);
+    for(int i = 0; i < 32; i++) {
+      rom.Op(0x6000 | ((i * 16) & 127));
+      rom.Op(0x6100 | ((i / 8) * 16));
+      rom.Op(0xD010);
+    }
+  };
+  roms.push_back(Make("scroll", "00CN 00DN 00FB 00FC in 128x64", true, fill_screen,
+    [](RomBuilder &rom, int i) {
+      static const uint16_t ops[] = { 0x00C3, 0x00FB, 0x00D3, 0x00FC };
+      rom.Op(ops[i % 4]);
+    },
+    [](RomBuilder &rom) { SpriteData(rom, 32); }));
+
+  roms.push_back(Make("bcd", "FX33", false,
+    [](RomBuilder &rom) { SetRegisters(rom); rom.Op(0xA000 | DATA); },
+    [](RomBuilder &rom, int i) { rom.Op(0xF033 | (i % 15) << 8); }, Nothing));
+
+  roms.push_back(Make("store/load", "FX55 FX65 with X = 0..F", false,
+    [](RomBuilder &rom) { SetRegisters(rom); rom.Op(0xA000 | DATA); },
+    [](RomBuilder &rom, int i) {
+      int x = (i / 2) % 16;
+      rom.Op((i & 1 ? 0xF065 : 0xF055) | x << 8);
+    }, Nothing));
+
+  return roms;
+}
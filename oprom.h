@@ -0,0 +1,19 @@
+#pragma once
+// Generated microbenchmark ROMs, each one stresses a single opcode family.
+// A ROM sets up registers and data once, then repeats a loop of UNROLL
+// copies of the instructions under test and one 1NNN back to the top, so
+// close to every executed instruction is one of them (./bench --opcodes).
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct OpcodeRom {
+  std::string name;
+  std::string description;
+  std::vector<uint8_t> data; // loaded at 0x200
+  bool hires;                // switches to 128x64 first
+};
+
+// all of them: alu, skips, calls, draws at aligned and unaligned x, hires
+// 16x16 sprites, scrolls and BCD/store/load
+std::vector<OpcodeRom> OpcodeRoms();
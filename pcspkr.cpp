@@ -0,0 +1,40 @@
+// sound timer tone through the motherboard buzzer
+#include <cstdio>
+#include <cstring>
+#include <linux/input.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+class PcSpeaker : public AudioSink {
+
+  private:
+    const char *SPKR_PATH = "/dev/input/by-path/platform-pcspkr-event-spkr";
+    struct input_event ev;
+    int speaker;
+
+    void Write(int value) {
+      ev.value = value;
+      if(write(speaker, &ev, sizeof(struct input_event)) < 0)
+        printf("cant speak");
+    }
+
+  public:
+    PcSpeaker() {
+      speaker = open(SPKR_PATH, O_RDWR);
+      memset(&ev, 0, sizeof(ev));
+      ev.type = EV_SND;
+      ev.code = SND_TONE;
+    }
+
+    // don't leave it beeping
+    ~PcSpeaker() {
+      if(speaker < 0) return;
+      Write(0);
+      close(speaker);
+    }
+
+    void Play() override { Write(200); }
+    void Stop() override { Write(0); }
+};
@@ -0,0 +1,82 @@
+// Hot address and loop report, see profile.h.
+#include <cstdio>
+#include <memory>
+#include <algorithm>
+#include "profile.h"
+
+static uint16_t Word(const Chip8 &chip8, int addr){
+  return chip8.memory[addr & 0xFFF] << 8 | chip8.memory[(addr + 1) & 0xFFF];
+}
+
+static bool IsSkip(uint16_t op){
+  switch(op & 0xF000) {
+    case 0x3000: case 0x4000: return true;
+    case 0x5000: case 0x9000: return (op & 0xF) == 0;
+    case 0xE000: return (op & 0xFF) == 0x9E || (op & 0xFF) == 0xA1;
+  }
+  return false;
+}
+
+std::vector<HotLoop> FindHotLoops(const Chip8 &chip8, const OpcodeStats &stats){
+
+  std::vector<HotLoop> loops;
+  for(int addr = 0; addr < 4096; addr++) {
+    if(stats.address_count[addr] == 0) continue;
+    uint16_t op = Word(chip8, addr);
+    if((op & 0xF000) != 0x1000 || (op & 0xFFF) > addr) continue;
+    // jumped back once is a retry or a restart, not a loop
+    if(stats.address_count[addr] < 2) continue;
+
+    HotLoop loop;
+    loop.start = op & 0xFFF;
+    loop.end = addr;
+    loop.conditional = addr >= 2 && stats.address_count[addr - 2] && IsSkip(Word(chip8, addr - 2));
+    loop.iterations = stats.address_count[addr];
+    loop.executed = 0;
+    for(int a = loop.start; a <= loop.end; a++) loop.executed += stats.address_count[a];
+    loops.push_back(loop);
+  }
+  std::sort(loops.begin(), loops.end(), [](const HotLoop &a, const HotLoop &b) { return a.executed > b.executed; });
+  return loops;
+}
+
+bool WriteProfile(const char *filename, const Chip8 &chip8, const OpcodeStats &stats, unsigned int max_loops){
+
+  std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(filename, "w"), fclose);
+  if(file == nullptr) return false;
+  FILE *f = file.get();
+
+  uint64_t total = 0;
+  std::vector<int> addrs;
+  for(int addr = 0; addr < 4096; addr++) {
+    total += stats.address_count[addr];
+    if(stats.address_count[addr]) addrs.push_back(addr);
+  }
+  std::sort(addrs.begin(), addrs.end(), [&](int a, int b) { return stats.address_count[a] > stats.address_count[b]; });
+  auto share = [&](uint64_t n) { return total ? 100.0 * n / total : 0.0; };
+
+  fprintf(f, "instructions: %llu at %zu addresses\n\n", (unsigned long long)total, addrs.size());
+
+  fprintf(f, "hottest addresses:\n");
+  for(size_t i = 0; i < std::min<size_t>(addrs.size(), 16); i++) {
+    int a = addrs[i];
+    fprintf(f, "  %03x %12llu %6.2f%%  %04x %s\n", a, (unsigned long long)stats.address_count[a],
+            share(stats.address_count[a]), Word(chip8, a), chip8.Mnemonic(Word(chip8, a)).c_str());
+  }
+
+  std::vector<HotLoop> loops = FindHotLoops(chip8, stats);
+  fprintf(f, "\nhot loops (%zu found):\n", loops.size());
+  for(size_t i = 0; i < std::min<size_t>(loops.size(), max_loops); i++) {
+    const HotLoop &loop = loops[i];
+    fprintf(f, "\n#%zu %03x-%03x %s, %llu iterations, %llu instructions (%.2f%%)\n", i + 1, loop.start, loop.end,
+            loop.conditional ? "skip + jump" : "jump", (unsigned long long)loop.iterations,
+            (unsigned long long)loop.executed, share(loop.executed));
+    for(int a = loop.start; a <= loop.end; a++) {
+      // only what ran, which also keeps odd addresses of even code out
+      if(stats.address_count[a] == 0) continue;
+      fprintf(f, "  %03x %12llu  %04x %s\n", a, (unsigned long long)stats.address_count[a],
+              Word(chip8, a), chip8.Mnemonic(Word(chip8, a)).c_str());
+    }
+  }
+  return ferror(f) == 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+// Where guest time goes, from the per-address counts in OpcodeStats.
+// Loops are found from backward 1NNN jumps that were executed, a skip right
+// before the jump makes it a conditional loop (the usual "SE, JP back").
+// Counts are of instructions, not host time, see OpcodeStats for that.
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+
+struct HotLoop {
+  uint16_t start;       // jump target, first instruction of the body
+  uint16_t end;         // the jump back
+  bool conditional;     // a skip in front of the jump decides whether it loops
+  uint64_t iterations;  // executions of the jump
+  uint64_t executed;    // instructions executed from start to end
+};
+
+// loops that went around at least twice, most executed instructions first.
+// nested loops count the instructions of the inner ones too
+std::vector<HotLoop> FindHotLoops(const Chip8 &chip8, const OpcodeStats &stats);
+
+// text report: hottest addresses, then the top 'max_loops' loops with
+// the disassembly and count of every instruction in them
+bool WriteProfile(const char *filename, const Chip8 &chip8, const OpcodeStats &stats, unsigned int max_loops = 20);
@@ -9,10 +9,24 @@ Renderer::~Renderer(){
   glDeleteBuffers(1, &VBO);
   glDeleteBuffers(1, &VBO_text);
   glDeleteBuffers(1, &EBO);
-  //delete[] screenData;
+  if(heat_texture) glDeleteTextures(1, &heat_texture);
+
+  for(int i = 0; i < PBO_COUNT; i++){
+    if(pbo_fence[i]) glDeleteSync(pbo_fence[i]);
+  }
+  if(use_pbo){
+    if(pbo_persistent){
+      for(int i = 0; i < PBO_COUNT; i++){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(PBO_COUNT, pbo);
+  }
 }
 
-Renderer::Renderer(std::vector<uint8_t> *screen_ptr): screen(screen_ptr){};
+Renderer::Renderer(const Chip8 *chip8): chip8(chip8){};
 
 
 void Renderer::Init(){
@@ -65,74 +79,149 @@ void Renderer::Init(){
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-  screenSize = screen->size();
-  screenData.resize(screenSize);
-  //screenData = new uint8_t[screenSize];
-  //memset(screenData, 0, screenSize * sizeof(screenData[0]));
-
-  //printf("screenSize: %d", screenSize);
-  
-  if(screenSize == 2048){
-   screenWidth = 64;
-   screenHeight = 32;
-  } else {
-    screenWidth = 128;
-    screenHeight = 64;
- }
-
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, screenWidth, screenHeight, 0, GL_RED, GL_UNSIGNED_BYTE, &screenData[0]);
-
-  const GLint swizzleMask[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
-  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
+  screenWidth = chip8->screen_width;
+  screenHeight = chip8->screen_height;
+
+  // the packed display goes to the gpu as it is, one texel is 32 pixels and
+  // fshader.fs picks the bit. lores only uses the left half of the texture
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, TEXTURE_WIDTH, 64, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, chip8->DisplayRow(0));
+
+  if(use_pbo){
+    glGenBuffers(PBO_COUNT, pbo);
+    pbo_persistent = GLAD_GL_VERSION_4_4;
+    for(int i = 0; i < PBO_COUNT; i++){
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+      if(pbo_persistent){
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, PBO_SIZE, nullptr, flags);
+        pbo_map[i] = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, PBO_SIZE, flags);
+      }
+      else glBufferData(GL_PIXEL_UNPACK_BUFFER, PBO_SIZE, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  if(gl_stats){
+    printf("gl: %s, texture upload %s\n", glGetString(GL_RENDERER),
+           !use_pbo ? "direct" : pbo_persistent ? "persistent pbo ring" : "pbo ring");
+    stats.start = std::chrono::steady_clock::now();
+  }
 
 }
 
 void Renderer::ExtendedModeChange(int mode){
-  glBindTexture(GL_TEXTURE_2D, texture);
   // change to normal mode
   if(mode == 0){
-    screenData.resize(64 * 32);
-    screenSize = 64 * 32;
     screenWidth = 64;
     screenHeight = 32;
   }
   else {
-    screenData.resize(128 * 64);
-    screenSize = 128 * 64;
     screenWidth = 128;
     screenHeight = 64;
   }
-  // override TexImage  
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, screenWidth, screenHeight, 0, GL_RED, GL_UNSIGNED_BYTE, &screenData[0]);
-  const GLint swizzleMask[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
-  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
 }
 
-void Renderer::UpdateTexture() { 
+void Renderer::UpdateTexture(const uint64_t *display, uint64_t dirty_rows) { 
   
-  for(unsigned int i = 0; i < screenSize; i++){
-    if(screen->at(i) == 0)
-      screenData.at(i) = 0;
-    else
-      screenData.at(i) = 255;
- }
- 
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screenWidth, screenHeight, GL_RED, GL_UNSIGNED_BYTE, &screenData[0]);
-  const GLint swizzleMask[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
-  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
+  auto start = std::chrono::steady_clock::now();
+  double wait_us = 0;
+
+  dirty_rows &= ~0ull >> (64 - screenHeight);
+  const int ROW_BYTES = Chip8::DISPLAY_ROW_WORDS * sizeof(uint64_t);
+  const uint8_t *src = (const uint8_t*)display;
+
+  if(use_pbo){
+    int i = pbo_index;
+    pbo_index = (pbo_index + 1) % PBO_COUNT;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+
+    // the gpu read this one PBO_COUNT uploads ago, it's almost never still busy
+    if(pbo_fence[i]){
+      auto wait = std::chrono::steady_clock::now();
+      glClientWaitSync(pbo_fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+      glDeleteSync(pbo_fence[i]);
+      pbo_fence[i] = nullptr;
+      wait_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - wait).count();
+    }
+    // the whole display is copied, it's 1 KB
+    uint8_t *dst = pbo_persistent ? pbo_map[i] :
+      (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, PBO_SIZE, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(dst, src, screenHeight * ROW_BYTES);
+    if(!pbo_persistent) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    // with a bound unpack buffer the pointer is an offset into it
+    src = nullptr;
+  }
+
+  // every run of changed rows is uploaded at once
+  while(dirty_rows){
+    unsigned int first = __builtin_ctzll(dirty_rows);
+    unsigned int last = first;
+    while(last + 1 < screenHeight && (dirty_rows >> (last + 1)) & 1) last++;
+    dirty_rows &= (last + 1 < 64) ? ~0ull << (last + 1) : 0;
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, TEXTURE_WIDTH, last - first + 1, GL_RED_INTEGER, GL_UNSIGNED_INT, src + first * ROW_BYTES);
+  }
 
+  if(use_pbo){
+    pbo_fence[(pbo_index + PBO_COUNT - 1) % PBO_COUNT] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  if(gl_stats){
+    auto end = std::chrono::steady_clock::now();
+    stats.uploads++;
+    stats.upload_us += std::chrono::duration<double, std::micro>(end - start).count();
+    stats.wait_us += wait_us;
+    if(end - stats.start >= std::chrono::seconds(1)){
+      printf("gl: %u uploads, %.2f us per upload, %.2f us of it waiting for the gpu\n",
+             stats.uploads, stats.upload_us / stats.uploads, stats.wait_us / stats.uploads);
+      stats.start = end;
+      stats.uploads = 0;
+      stats.upload_us = stats.wait_us = 0;
+    }
+  }
 }
 
 
 
-void Renderer::Render(Shader &shader, bool update_texture){
+void Renderer::RenderHeatmap(Shader &shader, const float *heat){
+
+  if(!heat_texture){
+    glGenTextures(1, &heat_texture);
+    glBindTexture(GL_TEXTURE_2D, heat_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 64, 64, 0, GL_RED, GL_FLOAT, nullptr);
+  }
+
+  // 16KB, not worth a pbo
+  glBindTexture(GL_TEXTURE_2D, heat_texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 64, 64, GL_RED, GL_FLOAT, heat);
+  glBindVertexArray(VAO);
+
+  shader.use();
+  shader.setInt("heatTex", 0);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+
+  glDisable(GL_BLEND);
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Renderer::Render(Shader &shader, const uint64_t *display, uint64_t dirty_rows){
   
   glBindTexture(GL_TEXTURE_2D, texture);
   glBindVertexArray(VAO);
  
   shader.use();
   shader.setInt("myTex", 0);
-  if(update_texture) UpdateTexture();
+  shader.setInt("screenWidth", screenWidth);
+  shader.setInt("screenHeight", screenHeight);
+  if(dirty_rows) UpdateTexture(display, dirty_rows);
   
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
   
@@ -5,34 +5,66 @@
 #include <map>
 #include <string>
 #include <filesystem>
+#include <chrono>
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
 #include "shaders.h"
+#include "chip8.h"
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
 class Renderer {
 
   public:
-    Renderer(std::vector<uint8_t> *screen_ptr);
+    Renderer(const Chip8 *chip8);
     ~Renderer();
-    void Render(Shader &shader, bool update_texture);
+    // uploads the rows set in dirty_rows (bit y is row y) of the packed
+    // display before drawing
+    void Render(Shader &shader, const uint64_t *display, uint64_t dirty_rows);
+    // draws 'heat' (4096 values in 0..1, one per guest address) over
+    // whatever is on screen
+    void RenderHeatmap(Shader &shader, const float *heat);
     void RenderText(Shader &text_shader, std::string text, float x, float y, float scale, glm::vec3 color);
     void Init();
     int FontInit(Shader &text_shader, int fb_width, int fb_height);
-    void UpdateTexture();
+    void UpdateTexture(const uint64_t *display, uint64_t dirty_rows);
     void ExtendedModeChange(int mode);
     int font_size;
+    // upload through the pbo ring, otherwise straight from client memory.
+    // off by default: at 1 KB a frame the ring measured 3-5x slower per
+    // upload than plain glTexSubImage2D on mesa llvmpipe, see --gl-stats
+    bool use_pbo = false;
+    // print upload timings every second
+    bool gl_stats = false;
 
   private:
-    std::vector<uint8_t> *screen;
-    std::vector<uint8_t> screenData;
-    //uint8_t *screenData;
-    unsigned int screenSize, screenWidth, screenHeight;
+    const Chip8 *chip8;
+    // 32 bit texels in a display row
+    static const int TEXTURE_WIDTH = Chip8::DISPLAY_ROW_WORDS * 2;
+    unsigned int screenWidth, screenHeight;
     GLuint texture, VBO, VBO_text, VAO, VAO_text, EBO;
+    // made on the first RenderHeatmap
+    GLuint heat_texture = 0;
+
+    // the display is copied into one of these and the texture is filled
+    // from it by the gpu, so the upload doesn't wait for the driver.
+    // mapped once for good when the driver has buffer storage (GL 4.4)
+    static const int PBO_COUNT = 3;
+    static const int PBO_SIZE = 64 * Chip8::DISPLAY_ROW_WORDS * sizeof(uint64_t);
+    GLuint pbo[PBO_COUNT];
+    GLsync pbo_fence[PBO_COUNT] = {};
+    uint8_t *pbo_map[PBO_COUNT] = {};
+    bool pbo_persistent = false;
+    int pbo_index = 0;
+
+    struct {
+      std::chrono::steady_clock::time_point start;
+      unsigned int uploads = 0;
+      double upload_us = 0, wait_us = 0;
+    } stats;
     glm::mat4 projection;
 
     struct Character {
@@ -0,0 +1,130 @@
+// Rewind history, see rewind.h.
+#include <cstring>
+#include "rewind.h"
+
+Rewind::Rewind(unsigned int frames, size_t bytes) : data(bytes), entries(frames) {}
+
+void Rewind::Clear(){
+  write_pos = 0;
+  first = 0;
+  count = 0;
+  need_key = true;
+}
+
+size_t Rewind::BytesUsed() const {
+  if(count == 0) return 0;
+  size_t oldest = At(first).offset;
+  size_t end = At(first + count - 1).offset + At(first + count - 1).size;
+  return (end > oldest) ? end - oldest : data.size() - oldest + end;
+}
+
+void Rewind::DropOldest(){
+  first++;
+  count--;
+  // deltas are useless without their keyframe
+  while(count && !At(first).is_key) {
+    first++;
+    count--;
+  }
+}
+
+// room for 'size' bytes, drops the oldest entries that are in the way
+size_t Rewind::Reserve(size_t size){
+  if(write_pos + size > data.size()) {
+    // everything between here and the end is older than what's at the start
+    while(count && At(first).offset >= write_pos) DropOldest();
+    write_pos = 0;
+  }
+  while(count && At(first).offset < write_pos + size && At(first).offset + At(first).size > write_pos)
+    DropOldest();
+  return write_pos;
+}
+
+void Rewind::Capture(const Chip8 &chip8){
+
+  if(count == entries.size()) DropOldest();
+  chip8.SaveState(state);
+
+  // worst case delta: every other word changed, 4 byte header per changed word
+  const size_t MAX_DELTA = WORDS * 12 + 4;
+  size_t offset = Reserve(MAX_DELTA);
+  uint8_t *out = &data[offset];
+  uint64_t n = first + count;
+
+  Entry &e = At(n);
+  e.offset = offset;
+
+  // the keyframe might just have been dropped to make room
+  if(need_key || since_key >= KEYFRAME_INTERVAL || count == 0 || last_key < first) {
+    memcpy(out, &state, sizeof(state));
+    key = state;
+    e.size = sizeof(state);
+    e.key = n;
+    e.is_key = true;
+    last_key = n;
+    since_key = 0;
+    need_key = false;
+  }
+  else {
+    // runs of changed words: uint16 words to skip, uint16 words that follow, the words XOR keyframe
+    const uint64_t *a = (const uint64_t*)&state, *b = (const uint64_t*)&key;
+    size_t size = 0;
+    for(size_t i = 0; i < WORDS;) {
+      size_t skip = i;
+      while(i < WORDS && a[i] == b[i]) i++;
+      if(i == WORDS) break;
+      size_t start = i;
+      while(i < WORDS && a[i] != b[i]) i++;
+
+      uint16_t header[2] = { (uint16_t)(start - skip), (uint16_t)(i - start) };
+      memcpy(out + size, header, sizeof(header));
+      size += sizeof(header);
+      for(size_t j = start; j < i; j++) {
+        uint64_t x = a[j] ^ b[j];
+        memcpy(out + size, &x, sizeof(x));
+        size += sizeof(x);
+      }
+    }
+    e.size = size;
+    e.key = last_key;
+    e.is_key = false;
+    since_key++;
+  }
+
+  write_pos = offset + e.size;
+  count++;
+}
+
+bool Rewind::Step(Chip8 &chip8){
+
+  // the newest state is where the machine already is, it's dropped and
+  // the one before it restored, which stays as the newest
+  if(count < 2) return false;
+  count--;
+  write_pos = At(first + count).offset;
+
+  const Entry &e = At(first + count - 1);
+  const Entry &k = At(e.key);
+
+  memcpy(&state, &data[k.offset], sizeof(state));
+  if(!e.is_key) {
+    uint64_t *a = (uint64_t*)&state;
+    const uint8_t *in = &data[e.offset];
+    size_t i = 0;
+    for(size_t pos = 0; pos < e.size;) {
+      uint16_t header[2];
+      memcpy(header, in + pos, sizeof(header));
+      pos += sizeof(header);
+      i += header[0];
+      for(int j = 0; j < header[1]; j++, i++, pos += sizeof(uint64_t)) {
+        uint64_t x;
+        memcpy(&x, in + pos, sizeof(x));
+        a[i] ^= x;
+      }
+    }
+  }
+
+  // 'key' may be a newer keyframe than this one, the next capture makes its own
+  need_key = true;
+  return chip8.LoadState(state);
+}
@@ -0,0 +1,59 @@
+#pragma once
+// Rewind history: one Chip8::State per frame, kept as a ring of XOR deltas
+// against the last keyframe, which is a full State every KEYFRAME_INTERVAL
+// frames. Deltas only store the 8 byte words that changed, so a frame where
+// a few registers, some memory and a couple of display rows changed takes
+// a few hundred bytes instead of a whole State.
+// Everything is allocated up front, Capture and Rewind never allocate.
+#include <stdint.h>
+#include <vector>
+
+#include "chip8.h"
+
+class Rewind {
+
+  public:
+    // keeps at most 'frames' states, in at most 'bytes' of memory
+    Rewind(unsigned int frames = 60 * 60, size_t bytes = 8 << 20);
+
+    // appends the state after a frame
+    void Capture(const Chip8 &chip8);
+    // goes back one frame, false when there's nothing older left
+    bool Step(Chip8 &chip8);
+    void Clear();
+
+    unsigned int Frames() const { return count; }
+    size_t BytesUsed() const;
+
+    static const unsigned int KEYFRAME_INTERVAL = 60;
+
+  private:
+    static const size_t WORDS = sizeof(Chip8::State) / sizeof(uint64_t);
+    static_assert(sizeof(Chip8::State) % sizeof(uint64_t) == 0, "State has to be whole words");
+
+    struct Entry {
+      size_t offset, size;  // in data
+      uint64_t key;         // entry number of its keyframe
+      bool is_key;
+    };
+
+    // byte ring, entries are written one after another and start over
+    // at 0 when the next one might not fit
+    std::vector<uint8_t> data;
+    size_t write_pos = 0;
+    // entry ring, entries are numbered from the first capture on and the
+    // oldest one is 'first'
+    std::vector<Entry> entries;
+    uint64_t first = 0;
+    unsigned int count = 0;
+    uint64_t last_key = 0;
+    unsigned int since_key = 0;
+    bool need_key = true;
+
+    Chip8::State state, key;
+
+    size_t Reserve(size_t size);
+    void DropOldest();
+    Entry &At(uint64_t n) { return entries[n % entries.size()]; }
+    const Entry &At(uint64_t n) const { return entries[n % entries.size()]; }
+};
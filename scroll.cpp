@@ -0,0 +1,117 @@
+// Scroll kernels for the packed display, see scroll.h.
+//
+// A display row is 16 bytes, so one SSE2 register holds a row with the
+// first word in the low lane, and one AVX2 register holds two rows.
+// Pixels that move between the words of a row are shifted across lanes
+// with a byte shift, which on AVX2 works per 128-bit lane, i.e. per row.
+// AVX2 is compiled with a target attribute and only used when the cpu
+// has it, so the build doesn't need -mavx2.
+// Vertical scrolls are whole row moves, memmove already does them with the
+// widest vectors the cpu has and hand written copies were slower
+// (./bench --scroll), so every set shares them.
+#include <cstring>
+#include "scroll.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const int ROW_WORDS = 2;
+
+static void ScrollRightScalar(uint64_t *display, int rows, bool hires){
+  for(int y = 0; y < rows; y++) {
+    uint64_t *row = &display[y * ROW_WORDS];
+    row[1] = hires ? (row[1] >> 4 | row[0] << 60) : 0;
+    row[0] >>= 4;
+  }
+}
+
+static void ScrollLeftScalar(uint64_t *display, int rows, bool hires){
+  for(int y = 0; y < rows; y++) {
+    uint64_t *row = &display[y * ROW_WORDS];
+    row[0] = row[0] << 4 | row[1] >> 60;
+    row[1] <<= 4;
+  }
+}
+
+static void ScrollDownScalar(uint64_t *display, int rows, int n){
+  memmove(&display[n * ROW_WORDS], display, (rows - n) * ROW_WORDS * sizeof(uint64_t));
+  memset(display, 0, n * ROW_WORDS * sizeof(uint64_t));
+}
+
+static void ScrollUpScalar(uint64_t *display, int rows, int n){
+  memmove(display, &display[n * ROW_WORDS], (rows - n) * ROW_WORDS * sizeof(uint64_t));
+  memset(&display[(rows - n) * ROW_WORDS], 0, n * ROW_WORDS * sizeof(uint64_t));
+}
+
+const ScrollKernels scroll_scalar = {
+  "scalar", ScrollRightScalar, ScrollLeftScalar, ScrollDownScalar, ScrollUpScalar
+};
+
+#if defined(__x86_64__)
+
+// lores keeps the second word at 0
+static inline __m128i RowMask128(bool hires){
+  return hires ? _mm_set1_epi64x(-1) : _mm_set_epi64x(0, -1);
+}
+
+static void ScrollRightSse2(uint64_t *display, int rows, bool hires){
+  __m128i mask = RowMask128(hires);
+  __m128i *p = (__m128i*)display;
+  for(int y = 0; y < rows; y++) {
+    __m128i row = _mm_loadu_si128(p + y);
+    // low bits of the first word become the high bits of the second
+    __m128i carry = _mm_slli_si128(_mm_slli_epi64(row, 60), 8);
+    _mm_storeu_si128(p + y, _mm_and_si128(_mm_or_si128(_mm_srli_epi64(row, 4), carry), mask));
+  }
+}
+
+static void ScrollLeftSse2(uint64_t *display, int rows, bool hires){
+  __m128i *p = (__m128i*)display;
+  for(int y = 0; y < rows; y++) {
+    __m128i row = _mm_loadu_si128(p + y);
+    __m128i carry = _mm_srli_si128(_mm_srli_epi64(row, 60), 8);
+    _mm_storeu_si128(p + y, _mm_or_si128(_mm_slli_epi64(row, 4), carry));
+  }
+}
+
+const ScrollKernels scroll_sse2 = {
+  "sse2", ScrollRightSse2, ScrollLeftSse2, ScrollDownScalar, ScrollUpScalar
+};
+
+// screen heights are even, so rows always come in pairs
+__attribute__((target("avx2")))
+static void ScrollRightAvx2(uint64_t *display, int rows, bool hires){
+  __m256i mask = hires ? _mm256_set1_epi64x(-1) : _mm256_set_epi64x(0, -1, 0, -1);
+  __m256i *p = (__m256i*)display;
+  for(int y = 0; y < rows / 2; y++) {
+    __m256i row = _mm256_loadu_si256(p + y);
+    __m256i carry = _mm256_slli_si256(_mm256_slli_epi64(row, 60), 8);
+    _mm256_storeu_si256(p + y, _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(row, 4), carry), mask));
+  }
+}
+
+__attribute__((target("avx2")))
+static void ScrollLeftAvx2(uint64_t *display, int rows, bool hires){
+  __m256i *p = (__m256i*)display;
+  for(int y = 0; y < rows / 2; y++) {
+    __m256i row = _mm256_loadu_si256(p + y);
+    __m256i carry = _mm256_srli_si256(_mm256_srli_epi64(row, 60), 8);
+    _mm256_storeu_si256(p + y, _mm256_or_si256(_mm256_slli_epi64(row, 4), carry));
+  }
+}
+
+const ScrollKernels scroll_avx2 = {
+  "avx2", ScrollRightAvx2, ScrollLeftAvx2, ScrollDownScalar, ScrollUpScalar
+};
+
+#endif
+
+const ScrollKernels &BestScrollKernels(){
+#if defined(__x86_64__)
+  static const ScrollKernels &best = __builtin_cpu_supports("avx2") ? scroll_avx2 : scroll_sse2;
+  return best;
+#else
+  return scroll_scalar;
+#endif
+}
@@ -0,0 +1,24 @@
+#pragma once
+// Scroll kernels for the packed display (see Chip8::display in chip8.h).
+// Every row is 2 words, MSB of the first one is x = 0, in lores only the
+// first word is visible and the second one has to stay 0.
+#include <stdint.h>
+
+struct ScrollKernels {
+  const char *name;
+  // 4 pixels right/left, 'rows' is the screen height
+  void (*right)(uint64_t *display, int rows, bool hires);
+  void (*left)(uint64_t *display, int rows, bool hires);
+  // n rows down (SCHIP 00CN) and up (XO-CHIP 00DN), n <= rows
+  void (*down)(uint64_t *display, int rows, int n);
+  void (*up)(uint64_t *display, int rows, int n);
+};
+
+extern const ScrollKernels scroll_scalar;
+#if defined(__x86_64__)
+extern const ScrollKernels scroll_sse2;
+extern const ScrollKernels scroll_avx2;
+#endif
+
+// fastest set the cpu supports, picked on first use
+const ScrollKernels &BestScrollKernels();
@@ -0,0 +1,131 @@
+// DXYN works on the packed display a whole row at a time: sprite rows are
+// shifted into one or two words and XORed in, and VF is set if any of them
+// overlapped. Every core draws sequences of sprites here, and the screen and
+// VF are compared with a pixel-by-pixel model. The sequences cover aligned
+// and unaligned sprites, the right and bottom edges, 16x16 sprites across the
+// word boundary, lores and hires, and wrapping and clip.
+// exits 1 on the first failure
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include "../chip8.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char *core, const char *what, int expected, int got){
+  if(ok) return;
+  printf("FAIL %s: %s, expected %d got %d\n", core, what, expected, got);
+  failures++;
+}
+
+struct Draw { uint8_t x, y, n; };
+
+// sprite rows at 0x300, every byte different
+static uint8_t SpriteByte(int i){ return (i * 37 + 0x5B) & 0xFF; }
+
+// what DXYN is specified to do, one pixel at a time
+struct Screen {
+  bool pixels[64][128] = {};
+  int width, height;
+
+  Screen(bool hires) : width(hires ? 128 : 64), height(hires ? 64 : 32) {}
+
+  int Draw(const ::Draw &d, bool clip_quirk){
+    bool big = d.n == 0;
+    int rows = big ? 16 : d.n, bits = big ? 16 : 8;
+    bool clip = clip_quirk || big;
+    int x = d.x % width, y = d.y % height;
+    int collision = 0;
+    for(int j = 0; j < rows; j++) {
+      int py = y + j;
+      if(py >= height) {
+        if(clip) break;
+        py -= height;
+      }
+      for(int i = 0; i < bits; i++) {
+        int px = x + i;
+        if(px >= width) {
+          if(clip) continue;
+          px -= width;
+        }
+        int byte = j * (bits / 8) + i / 8;
+        if(!((SpriteByte(byte) >> (7 - i % 8)) & 1)) continue;
+        if(pixels[py][px]) collision = 1;
+        pixels[py][px] = !pixels[py][px];
+      }
+    }
+    return collision;
+  }
+};
+
+// draws every sprite from I = 0x300 and keeps each VF in V2, V3...
+static std::vector<uint8_t> DrawRom(bool hires, const std::vector<Draw> &draws){
+  std::vector<uint8_t> rom;
+  if(hires) rom.insert(rom.end(), { 0x00, 0xFF });
+  for(size_t k = 0; k < draws.size(); k++) {
+    const Draw &d = draws[k];
+    rom.insert(rom.end(), { 0x60, d.x, 0x61, d.y, 0xA3, 0x00, 0xD0, (uint8_t)(0x10 | d.n),
+                            (uint8_t)(0x82 + k), 0xF0 });
+  }
+  uint16_t loop = 0x200 + rom.size();
+  rom.insert(rom.end(), { (uint8_t)(0x10 | loop >> 8), (uint8_t)loop });
+  rom.resize(0x100);
+  for(int i = 0; i < 32; i++) rom.push_back(SpriteByte(i));
+  return rom;
+}
+
+int main(){
+
+  struct Case { const char *name; bool hires; std::vector<Draw> draws; };
+  const Case cases[] = {
+    { "lores aligned", false, { {0, 0, 5}, {8, 0, 5}, {0, 0, 5} } },
+    { "lores unaligned", false, { {3, 2, 5}, {5, 4, 5}, {13, 2, 7} } },
+    { "lores right edge", false, { {60, 10, 4}, {57, 11, 6}, {63, 12, 2}, {70, 3, 3} } },
+    { "lores bottom edge", false, { {20, 30, 4}, {21, 28, 6}, {62, 31, 3}, {9, 63, 2} } },
+    { "lores 16x16", false, { {5, 3, 0}, {56, 8, 0}, {60, 28, 0}, {9, 10, 0} } },
+    { "hires aligned", true, { {0, 0, 8}, {64, 0, 8}, {120, 9, 8}, {64, 4, 8} } },
+    { "hires unaligned", true, { {61, 3, 8}, {59, 5, 8}, {1, 20, 5}, {200, 40, 6} } },
+    { "hires right edge", true, { {125, 5, 8}, {122, 7, 4}, {127, 8, 1} } },
+    { "hires bottom edge", true, { {40, 62, 4}, {42, 60, 8}, {126, 63, 3} } },
+    { "hires 16x16", true, { {56, 20, 0}, {48, 22, 0}, {64, 24, 0}, {120, 60, 0}, {3, 55, 0} } },
+  };
+
+  struct { const char *name; Chip8::Core core; } cores[] = {
+    { "table", Chip8::Core::Table },
+    { "threaded", Chip8::Core::Threaded },
+    { "jit", Chip8::Core::Jit },
+  };
+
+  char what[128];
+  for(auto &c : cores) {
+    for(const Case &t : cases) {
+      for(bool clip : { false, true }) {
+        Chip8 chip8;
+        struct Chip8::Quirks quirks;
+        quirks.clip_sprite = clip;
+        chip8.SetQuirks(quirks);
+        chip8.core = c.core;
+        std::vector<uint8_t> rom = DrawRom(t.hires, t.draws);
+        chip8.LoadRom(rom.data(), rom.size());
+        chip8.RunCycles(1 + t.draws.size() * 5 + 10);
+
+        Screen screen(t.hires);
+        for(size_t k = 0; k < t.draws.size(); k++) {
+          int vf = screen.Draw(t.draws[k], clip);
+          snprintf(what, sizeof(what), "%s%s, VF of draw %zu", t.name, clip ? " clip" : "", k);
+          Check(chip8.V[2 + k] == vf, c.name, what, vf, chip8.V[2 + k]);
+        }
+
+        int wrong = 0;
+        for(int y = 0; y < screen.height; y++)
+          for(int x = 0; x < screen.width; x++) wrong += chip8.Pixel(x, y) != screen.pixels[y][x];
+        snprintf(what, sizeof(what), "%s%s, wrong pixels", t.name, clip ? " clip" : "");
+        Check(wrong == 0, c.name, what, 0, wrong);
+      }
+    }
+  }
+
+  if(failures == 0) puts("draw: ok");
+  return failures ? 1 : 0;
+}
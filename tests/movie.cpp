@@ -0,0 +1,102 @@
+// A movie has to play back bit for bit: a recording made on one core plays
+// on every core and has to end on the same screen, instruction count and
+// registers. Games are recorded with scripted input, in the way the window
+// feeds keys to Movie::Input, with quirks, speed and seed that differ from
+// the defaults, so Start has to bring all of them back. It also refuses
+// another ROM.
+// exits 1 on the first failure
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include "../chip8.h"
+#include "../movie.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char *core, const char *what, int expected, int got){
+  if(ok) return;
+  printf("FAIL %s: %s, expected %d got %d\n", core, what, expected, got);
+  failures++;
+}
+
+// uneven timing on purpose: a key goes down every 23 frames and up 9 later
+static void ScriptedInput(Chip8 &chip8, Movie &movie, uint64_t frame){
+  int key = (frame / 23 * 5) % 16;
+  if(frame % 23 == 0 || frame % 23 == 9) {
+    chip8.last_key_pressed = -1;
+    chip8.SetKey(key, frame % 23 == 0);
+    movie.Input(chip8);
+  }
+}
+
+int main(){
+
+  const char *roms[] = { "c8games/BRIX", "c8games/TETRIS", "c8games/BLINKY" };
+  const char *file = "tests/movie.tmp";
+  const uint64_t FRAMES = 900;
+
+  struct { const char *name; Chip8::Core core; } cores[] = {
+    { "table", Chip8::Core::Table },
+    { "threaded", Chip8::Core::Threaded },
+    { "jit", Chip8::Core::Jit },
+  };
+
+  char what[128];
+  for(const char *rom : roms) {
+    for(auto &recorder : cores) {
+      Chip8 chip8;
+      chip8.core = recorder.core;
+      struct Chip8::Quirks quirks;
+      Chip8::ParseQuirks("shift", quirks);
+      chip8.SetQuirks(quirks);
+      chip8.cycles_per_frame = 200;
+      if(!chip8.LoadRom(rom)) {
+        Check(false, recorder.name, rom, 1, 0);
+        continue;
+      }
+
+      Movie movie;
+      movie.Record(chip8, 1234);
+      for(uint64_t frame = 0; frame < FRAMES; frame++) {
+        ScriptedInput(chip8, movie, frame);
+        chip8.RunUntilFrame();
+      }
+      Check(movie.Save(file, chip8), recorder.name, "movie saved", 1, 0);
+      uint64_t hash = chip8.ScreenHash();
+      uint64_t instructions = chip8.instructions;
+      uint8_t V[16];
+      memcpy(V, chip8.V, sizeof(V));
+
+      for(auto &player : cores) {
+        Chip8 playback;
+        playback.core = player.core;
+        playback.LoadRom(rom);
+        Movie loaded;
+        snprintf(what, sizeof(what), "%s recorded on %s, loads", rom, recorder.name);
+        Check(loaded.Load(file), player.name, what, 1, 0);
+        snprintf(what, sizeof(what), "%s recorded on %s, starts", rom, recorder.name);
+        Check(loaded.Start(playback), player.name, what, 1, 0);
+
+        while(!loaded.Finished(playback) && loaded.RunUntilFrame(playback) == Chip8::RunStatus::FrameEnd) {}
+
+        snprintf(what, sizeof(what), "%s recorded on %s, instructions", rom, recorder.name);
+        Check(playback.instructions == instructions, player.name, what, (int)instructions, (int)playback.instructions);
+        snprintf(what, sizeof(what), "%s recorded on %s, screen hash matches", rom, recorder.name);
+        Check(playback.ScreenHash() == hash, player.name, what, 1, 0);
+        snprintf(what, sizeof(what), "%s recorded on %s, registers match", rom, recorder.name);
+        Check(memcmp(playback.V, V, sizeof(V)) == 0, player.name, what, 1, 0);
+      }
+    }
+  }
+
+  // the movie left over is from the last ROM
+  Chip8 other;
+  other.LoadRom(roms[0]);
+  Movie loaded;
+  Check(loaded.Load(file) && !loaded.Start(other), "movie", "another ROM refused", 1, 0);
+  remove(file);
+
+  if(failures == 0) puts("movie: ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+// Every quirk changes what a ROM does, so each one is pinned here both ways:
+// BNNN jumps to NNN + V0, or to XNN + VX with jump. 1NNN never adds anything.
+// 8XY6/8XYE shift VY into VX, or VX in place with shift. DXYN wraps sprites
+// around the edges, or cuts them off with clip.
+// exits 1 on the first failure
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include "../chip8.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char *core, const char *what, int expected, int got){
+  if(ok) return;
+  printf("FAIL %s: %s, expected %d got %d\n", core, what, expected, got);
+  failures++;
+}
+
+// fresh machine with 'quirks' that ran 'cycles' instructions of 'rom'
+static void Run(Chip8 &chip8, Chip8::Core core, const char *quirks, const std::vector<uint8_t> &rom, uint64_t cycles){
+  struct Chip8::Quirks q;
+  Chip8::ParseQuirks(quirks, q);
+  chip8.SetQuirks(q);
+  chip8.core = core;
+  chip8.LoadRom(rom.data(), rom.size());
+  chip8.RunCycles(cycles);
+}
+
+int main(){
+
+  // V0 = 4, V2 = 8, B20A lands on 0x20E (+V0) or 0x212 (+V2), each sets V3
+  const std::vector<uint8_t> bnnn_rom = {
+    0x60, 0x04, 0x62, 0x08, 0xB2, 0x0A, 0x12, 0x06, 0x12, 0x08, 0x12, 0x0A, 0x12, 0x0C,
+    0x63, 0x01, 0x12, 0x10,
+    0x63, 0x02, 0x12, 0x14,
+  };
+  // V0 = 4, V2 = 8, 120C goes to 0x20C whatever the registers hold
+  const std::vector<uint8_t> jp_rom = {
+    0x60, 0x04, 0x62, 0x08, 0x12, 0x0C, 0x63, 0x09, 0x63, 0x09, 0x63, 0x09,
+    0x63, 0x03, 0x12, 0x0E,
+  };
+  // V1 = 81, V2 = 06, 8126, VA = VF, V4 = 81, V5 = 06, 845E, loop
+  const std::vector<uint8_t> shift_rom = {
+    0x61, 0x81, 0x62, 0x06, 0x81, 0x26, 0x8A, 0xF0,
+    0x64, 0x81, 0x65, 0x06, 0x84, 0x5E, 0x12, 0x0E,
+  };
+  // 4 rows of FF at (60, 30), past the right and the bottom edge
+  const std::vector<uint8_t> draw_rom = {
+    0x60, 0x3C, 0x61, 0x1E, 0xA2, 0x0A, 0xD0, 0x14, 0x12, 0x08,
+    0xFF, 0xFF, 0xFF, 0xFF,
+  };
+
+  struct { const char *name; Chip8::Core core; } cores[] = {
+    { "table", Chip8::Core::Table },
+    { "threaded", Chip8::Core::Threaded },
+    { "jit", Chip8::Core::Jit },
+  };
+
+  for(auto &c : cores) {
+    {
+      Chip8 chip8;
+      Run(chip8, c.core, "none", bnnn_rom, 20);
+      Check(chip8.V[3] == 1, c.name, "BNNN adds V0", 1, chip8.V[3]);
+    }
+    {
+      Chip8 chip8;
+      Run(chip8, c.core, "jump", bnnn_rom, 20);
+      Check(chip8.V[3] == 2, c.name, "BXNN adds VX with jump", 2, chip8.V[3]);
+    }
+    for(const char *quirks : { "none", "jump" }) {
+      Chip8 chip8;
+      Run(chip8, c.core, quirks, jp_rom, 20);
+      Check(chip8.V[3] == 3, c.name, "1NNN adds nothing", 3, chip8.V[3]);
+    }
+
+    {
+      Chip8 chip8;
+      Run(chip8, c.core, "none", shift_rom, 20);
+      Check(chip8.V[1] == 0x03, c.name, "8XY6 shifts VY", 0x03, chip8.V[1]);
+      Check(chip8.V[0xA] == 0, c.name, "8XY6 VF is bit 0 of VY", 0, chip8.V[0xA]);
+      Check(chip8.V[4] == 0x0C, c.name, "8XYE shifts VY", 0x0C, chip8.V[4]);
+      Check(chip8.V[0xF] == 0, c.name, "8XYE VF is bit 7 of VY", 0, chip8.V[0xF]);
+    }
+    {
+      Chip8 chip8;
+      Run(chip8, c.core, "shift", shift_rom, 20);
+      Check(chip8.V[1] == 0x40, c.name, "8XY6 shifts VX with shift", 0x40, chip8.V[1]);
+      Check(chip8.V[0xA] == 1, c.name, "8XY6 VF is bit 0 of VX with shift", 1, chip8.V[0xA]);
+      Check(chip8.V[4] == 0x02, c.name, "8XYE shifts VX with shift", 0x02, chip8.V[4]);
+      Check(chip8.V[0xF] == 1, c.name, "8XYE VF is bit 7 of VX with shift", 1, chip8.V[0xF]);
+    }
+
+    for(const char *quirks : { "none", "clip" }) {
+      bool clip = quirks[0] == 'c';
+      Chip8 chip8;
+      Run(chip8, c.core, quirks, draw_rom, 5);
+      int on = 0;
+      for(int y = 0; y < 32; y++)
+        for(int x = 0; x < 64; x++) on += chip8.Pixel(x, y);
+      Check(on == (clip ? 8 : 32), c.name, clip ? "pixels drawn with clip" : "pixels drawn wrapping", clip ? 8 : 32, on);
+      Check(chip8.Pixel(63, 31), c.name, "bottom right corner", 1, chip8.Pixel(63, 31));
+      Check(chip8.Pixel(0, 0) == !clip, c.name, clip ? "top left corner with clip" : "top left corner wrapped", !clip, chip8.Pixel(0, 0));
+      Check(chip8.Pixel(3, 1) == !clip, c.name, clip ? "last row with clip" : "last row wrapped", !clip, chip8.Pixel(3, 1));
+      Check(chip8.Pixel(4, 0) == 0, c.name, "past the sprite", 0, chip8.Pixel(4, 0));
+    }
+  }
+
+  if(failures == 0) puts("quirks: ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+// Rewinding has to restore exactly the state a frame ended with, although
+// most of them are rebuilt from a keyframe and an XOR delta. Each core plays
+// a game while capturing every frame and keeping a SaveState of it. Then it
+// steps all the way back and compares every restored frame with its
+// SaveState. The history is limited three ways: enough room for every frame,
+// fewer frames than were played, and too few bytes. It also plays on after
+// rewinding halfway, which has to end where the first run did.
+// exits 1 on the first failure
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "../chip8.h"
+#include "../rewind.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char *core, const char *what, int expected, int got){
+  if(ok) return;
+  printf("FAIL %s: %s, expected %d got %d\n", core, what, expected, got);
+  failures++;
+}
+
+// one key every half second, held for 10 frames, like bench
+static void PlayFrame(Chip8 &chip8, uint64_t frame){
+  int key = (frame / 30 * 7) % 16;
+  if(frame % 30 == 0) chip8.SetKey(key, true);
+  else if(frame % 30 == 10) chip8.SetKey(key, false);
+  chip8.RunUntilFrame();
+}
+
+// State has padding, zeroed first so whole states compare
+static void Save(const Chip8 &chip8, Chip8::State &out){
+  memset(&out, 0, sizeof(out));
+  chip8.SaveState(out);
+}
+
+// steps back to the oldest frame kept from 'frame', every one on the way has
+// to be exact. returns how many weren't
+static unsigned int StepBack(Chip8 &chip8, Rewind &rewind, unsigned int &frame,
+                             const std::vector<Chip8::State> &expected, const char *core, const char *name){
+  Chip8::State state;
+  unsigned int wrong = 0;
+  while(rewind.Step(chip8)) {
+    frame--;
+    Save(chip8, state);
+    if(memcmp(&state, &expected[frame], sizeof(state)) != 0) {
+      if(wrong == 0) printf("%s: %s, first wrong frame %u\n", core, name, frame);
+      wrong++;
+    }
+  }
+  return wrong;
+}
+
+int main(){
+
+  const unsigned int FRAMES = 400;
+
+  struct { const char *name; Chip8::Core core; } cores[] = {
+    { "table", Chip8::Core::Table },
+    { "threaded", Chip8::Core::Threaded },
+    { "jit", Chip8::Core::Jit },
+  };
+  // frames and bytes the history may keep
+  struct { const char *name; unsigned int frames; size_t bytes; } limits[] = {
+    { "everything", FRAMES, 8 << 20 },
+    { "100 frames", 100, 8 << 20 },
+    { "64 KB", FRAMES, 64 << 10 },
+  };
+
+  std::vector<Chip8::State> expected(FRAMES);
+  Chip8::State state;
+  char what[128];
+
+  for(auto &c : cores) {
+    for(auto &limit : limits) {
+      Chip8 chip8;
+      chip8.core = c.core;
+      chip8.cycles_per_frame = 500;
+      chip8.Seed(1);
+      if(!chip8.LoadRom("c8games/BRIX")) {
+        Check(false, c.name, "c8games/BRIX loads", 1, 0);
+        continue;
+      }
+
+      Rewind rewind(limit.frames, limit.bytes);
+      for(unsigned int frame = 0; frame < FRAMES; frame++) {
+        PlayFrame(chip8, frame);
+        rewind.Capture(chip8);
+        Save(chip8, expected[frame]);
+      }
+      unsigned int kept = rewind.Frames();
+      snprintf(what, sizeof(what), "%s: frames kept", limit.name);
+      Check(kept > 1 && kept <= limit.frames, c.name, what, limit.frames, kept);
+
+      unsigned int frame = FRAMES - 1;
+      unsigned int wrong = StepBack(chip8, rewind, frame, expected, c.name, limit.name);
+      snprintf(what, sizeof(what), "%s: frames stepped back", limit.name);
+      Check(frame == FRAMES - kept, c.name, what, FRAMES - kept, frame);
+      snprintf(what, sizeof(what), "%s: wrong frames", limit.name);
+      Check(wrong == 0, c.name, what, 0, wrong);
+    }
+
+    // halfway back and forward again, capturing on the way like the window does
+    Chip8 chip8;
+    chip8.core = c.core;
+    chip8.cycles_per_frame = 500;
+    chip8.Seed(1);
+    chip8.LoadRom("c8games/BRIX");
+    Rewind rewind(FRAMES);
+    for(unsigned int frame = 0; frame < FRAMES; frame++) {
+      PlayFrame(chip8, frame);
+      rewind.Capture(chip8);
+    }
+    for(unsigned int i = 0; i < FRAMES / 2; i++) rewind.Step(chip8);
+    for(unsigned int frame = FRAMES / 2; frame < FRAMES; frame++) {
+      PlayFrame(chip8, frame);
+      rewind.Capture(chip8);
+    }
+    Save(chip8, state);
+    Check(memcmp(&state, &expected[FRAMES - 1], sizeof(state)) == 0, c.name, "played on after a rewind", 1, 0);
+    // the frames from before and after the rewind are all in the history
+    unsigned int frame = FRAMES - 1;
+    unsigned int wrong = StepBack(chip8, rewind, frame, expected, c.name, "after playing on");
+    Check(frame == 0, c.name, "frames stepped back after playing on", 0, frame);
+    Check(wrong == 0, c.name, "wrong frames after playing on", 0, wrong);
+  }
+
+  if(failures == 0) puts("rewind: ok");
+  return failures ? 1 : 0;
+}
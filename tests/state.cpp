@@ -0,0 +1,146 @@
+// A save state has to bring back the exact machine: loading one and playing
+// the same input again must end where the first run did. Each core plays
+// some games, saves in memory and to a file, and plays on. Then it goes back
+// through every load path (memory, the mmap'd file, the file in a new
+// Chip8) and plays the same frames again. States of another version, with a
+// bad magic, or of the wrong size must be refused without touching the
+// machine.
+// exits 1 on the first failure
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <memory>
+
+#include "../chip8.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char *core, const char *what, int expected, int got){
+  if(ok) return;
+  printf("FAIL %s: %s, expected %d got %d\n", core, what, expected, got);
+  failures++;
+}
+
+// one key every half second, held for 10 frames, like bench
+static void PlayFrames(Chip8 &chip8, uint64_t from, uint64_t to){
+  for(uint64_t frame = from; frame < to; frame++) {
+    int key = (frame / 30 * 7) % 16;
+    if(frame % 30 == 0) chip8.SetKey(key, true);
+    else if(frame % 30 == 10) chip8.SetKey(key, false);
+    chip8.RunUntilFrame();
+  }
+}
+
+// what has to come out the same
+struct Snapshot {
+  uint64_t hash, instructions;
+  uint8_t V[16];
+  uint16_t I, pc;
+  uint8_t memory[4096];
+
+  explicit Snapshot(const Chip8 &chip8){
+    Chip8::State state;
+    chip8.SaveState(state);
+    hash = chip8.ScreenHash();
+    instructions = chip8.instructions;
+    memcpy(V, state.V, sizeof(V));
+    I = state.I;
+    pc = state.pc;
+    memcpy(memory, state.memory, sizeof(memory));
+  }
+};
+
+static void Compare(const Snapshot &expected, const Chip8 &chip8, const char *core, const char *path){
+  Snapshot got(chip8);
+  char what[128];
+  snprintf(what, sizeof(what), "%s: screen hash matches", path);
+  Check(got.hash == expected.hash, core, what, 1, 0);
+  snprintf(what, sizeof(what), "%s: instructions", path);
+  Check(got.instructions == expected.instructions, core, what, (int)expected.instructions, (int)got.instructions);
+  snprintf(what, sizeof(what), "%s: registers match", path);
+  Check(memcmp(got.V, expected.V, sizeof(got.V)) == 0 && got.I == expected.I && got.pc == expected.pc, core, what, 1, 0);
+  snprintf(what, sizeof(what), "%s: memory matches", path);
+  Check(memcmp(got.memory, expected.memory, sizeof(got.memory)) == 0, core, what, 1, 0);
+}
+
+int main(){
+
+  const char *roms[] = { "c8games/BRIX", "c8games/INVADERS", "c8games/TETRIS", "c8games/BLITZ" };
+  const char *file = "tests/state.tmp";
+  const uint64_t SAVE_AT = 300, END = 600;
+
+  struct { const char *name; Chip8::Core core; } cores[] = {
+    { "table", Chip8::Core::Table },
+    { "threaded", Chip8::Core::Threaded },
+    { "jit", Chip8::Core::Jit },
+  };
+
+  for(auto &c : cores) {
+    for(const char *rom : roms) {
+      Chip8 chip8;
+      chip8.core = c.core;
+      chip8.cycles_per_frame = 500;
+      chip8.Seed(1);
+      if(!chip8.LoadRom(rom)) {
+        Check(false, c.name, rom, 1, 0);
+        continue;
+      }
+
+      PlayFrames(chip8, 0, SAVE_AT);
+      // saved in the middle of a frame, the rest of it is played from the state
+      chip8.RunCycles(123);
+      std::unique_ptr<Chip8::State> saved(new Chip8::State);
+      chip8.SaveState(*saved);
+      Check(chip8.SaveState(file), c.name, "save to a file", 1, 0);
+      PlayFrames(chip8, SAVE_AT, END);
+      Snapshot expected(chip8);
+
+      Check(chip8.LoadState(*saved), c.name, "load from memory", 1, 0);
+      PlayFrames(chip8, SAVE_AT, END);
+      Compare(expected, chip8, c.name, "memory");
+
+      Check(chip8.LoadState(file), c.name, "load from the file", 1, 0);
+      PlayFrames(chip8, SAVE_AT, END);
+      Compare(expected, chip8, c.name, "file");
+
+      Chip8 other;
+      other.core = c.core;
+      other.cycles_per_frame = 500;
+      Check(other.LoadState(file), c.name, "load from the file in a new Chip8", 1, 0);
+      PlayFrames(other, SAVE_AT, END);
+      Compare(expected, other, c.name, "file in a new Chip8");
+    }
+  }
+
+  // refused states leave everything as it was
+  Chip8 chip8;
+  chip8.cycles_per_frame = 500;
+  chip8.Seed(1);
+  chip8.LoadRom(roms[0]);
+  PlayFrames(chip8, 0, 60);
+  std::unique_ptr<Chip8::State> state(new Chip8::State);
+  chip8.SaveState(*state);
+  Snapshot before(chip8);
+
+  state->magic ^= 1;
+  Check(!chip8.LoadState(*state), "state", "bad magic refused", 1, 0);
+  state->magic ^= 1;
+  state->version++;
+  Check(!chip8.LoadState(*state), "state", "other version refused", 1, 0);
+  Compare(before, chip8, "state", "after refused states");
+
+  FILE *f = fopen(file, "wb");
+  fwrite(state.get(), sizeof(Chip8::State), 1, f);
+  fclose(f);
+  Check(!chip8.LoadState(file), "state", "file of another version refused", 1, 0);
+  f = fopen(file, "wb");
+  fwrite(state.get(), sizeof(Chip8::State) - 8, 1, f);
+  fclose(f);
+  Check(!chip8.LoadState(file), "state", "truncated file refused", 1, 0);
+  remove(file);
+  Check(!chip8.LoadState(file), "state", "missing file refused", 1, 0);
+  Compare(before, chip8, "state", "after refused files");
+
+  if(failures == 0) puts("state: ok");
+  return failures ? 1 : 0;
+}
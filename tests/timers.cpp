@@ -0,0 +1,66 @@
+// Timers have to run at 60 Hz whatever the guest does, including sitting in
+// an FX0A key wait. Runs every core once per display frame like the window
+// does and checks when the sound stops and what the delay timer reads.
+// exits 1 on the first failure
+#include <cstdio>
+#include <stdint.h>
+
+#include "../chip8.h"
+
+// counts the frames the buzzer stays on
+struct Buzzer : AudioSink {
+  bool on = false;
+  void Play() override { on = true; }
+  void Stop() override { on = false; }
+};
+
+static int failures = 0;
+
+static void Check(bool ok, const char *core, const char *what, int expected, int got){
+  if(ok) return;
+  printf("FAIL %s: %s, expected %d got %d\n", core, what, expected, got);
+  failures++;
+}
+
+int main(){
+
+  // V0 = 16, ST = V0, wait for V1, loop
+  const uint8_t sound_rom[] = { 0x60, 0x10, 0xF0, 0x18, 0xF1, 0x0A, 0x12, 0x06 };
+  // V0 = 16, DT = V0, wait for V1, V2 = DT, loop
+  const uint8_t delay_rom[] = { 0x60, 0x10, 0xF0, 0x15, 0xF1, 0x0A, 0xF2, 0x07, 0x12, 0x08 };
+
+  struct { const char *name; Chip8::Core core; } cores[] = {
+    { "table", Chip8::Core::Table },
+    { "threaded", Chip8::Core::Threaded },
+    { "jit", Chip8::Core::Jit },
+  };
+
+  for(auto &c : cores) {
+    Buzzer buzzer;
+    Chip8 chip8;
+    chip8.core = c.core;
+    chip8.cycles_per_frame = 7;
+    chip8.audio = &buzzer;
+    chip8.LoadRom(sound_rom, sizeof(sound_rom));
+
+    int stopped = -1;
+    for(int frame = 0; frame < 200 && stopped < 0; frame++) {
+      Chip8::RunStatus status = chip8.RunUntilFrame();
+      Check(status == Chip8::RunStatus::FrameEnd, c.name, "key wait ends the frame", (int)Chip8::RunStatus::FrameEnd, (int)status);
+      if(!buzzer.on) stopped = frame;
+    }
+    // on for frames 0-14, off once frame 15 is over
+    Check(stopped == 15, c.name, "sound stops after 16 frames", 15, stopped);
+
+    chip8.Reset();
+    chip8.LoadRom(delay_rom, sizeof(delay_rom));
+    // waits through frames 0-4, reads DT in frame 5
+    for(int frame = 0; frame < 5; frame++) chip8.RunUntilFrame();
+    chip8.last_key_pressed = 1;
+    chip8.RunUntilFrame();
+    Check(chip8.V[2] == 11, c.name, "delay timer read after 5 frames of waiting", 11, chip8.V[2]);
+  }
+
+  if(failures == 0) puts("timers: ok");
+  return failures ? 1 : 0;
+}